@@ -14,6 +14,8 @@ Distributed as-is; no warranty is given.
 #include "stdint.h"
 
 #include "Wire.h"
+#define I2C_TRACE_INTERPOSE
+#include "I2C_trace.h"
 
 //****************************************************************************//
 //
@@ -81,7 +83,7 @@ kxtj3_status_t KXTJ3::readRegisterRegion(uint8_t *outputPointer , uint8_t offset
 	uint8_t c = 0;
 
   Wire.beginTransmission(I2CAddress);
-  offset |= 0x80; //turn auto-increment bit on, bit 7 for I2C
+  // The KXTJ3 auto-increments the register address on its own, bit 7 is part of the address
   Wire.write(offset);
   if( Wire.endTransmission() != 0 )
   {
@@ -207,6 +209,29 @@ float KXTJ3::axisAccel( axis_t _axis)
 
 	readRegisterInt16( &outRAW, regToRead );
 
+	return rawToG( outRAW );
+
+}
+
+//****************************************************************************//
+//  readAxes
+//
+//  Parameters:
+//    *xyz -- Pass array of 3 to save X, Y and Z to
+//****************************************************************************//
+kxtj3_status_t KXTJ3::readAxes( int16_t* xyz )
+{
+	uint8_t myBuffer[6];
+	kxtj3_status_t returnError = readRegisterRegion(myBuffer, KXTJ3_OUT_X_L, 6);  //Single transaction for all axes
+
+	for( uint8_t i = 0; i < 3; i++ )
+		xyz[i] = (int16_t)myBuffer[2*i] | int16_t(myBuffer[2*i + 1] << 8);
+
+	return returnError;
+}
+
+float KXTJ3::rawToG( int16_t outRAW )
+{
 	float outFloat;
 
 	switch( accelRange )
@@ -229,7 +254,6 @@ float KXTJ3::axisAccel( axis_t _axis)
 	}
 
 	return outFloat;
-
 }
 
 kxtj3_status_t	KXTJ3::standby( bool _en )
@@ -99,6 +99,13 @@ public:
 	// Read axis acceleration as Float
 	float axisAccel( axis_t _axis);
 
+	// Read the raw X, Y and Z outputs in one burst (XOUT_L..ZOUT_H)
+	// @xyz	array of 3 values, same scale as readRegisterInt16
+	kxtj3_status_t readAxes( int16_t* xyz );
+
+	// Convert a raw output to g for the configured range
+	float rawToG( int16_t raw );
+
 	// Set IMU to Standby ~0.9uA, also Enable configuration -> PC1 bit in CTRL_REG1 must first be set to “0”
 	kxtj3_status_t standby( bool _en = true );
 	
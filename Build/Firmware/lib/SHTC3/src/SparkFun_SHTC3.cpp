@@ -5,15 +5,16 @@ An Arduino library for the Sensirion SHTC3 humidity and temerature sensor
 */
 
 #include "SparkFun_SHTC3.h"
+#include "I2C_trace.h"
 
 SHTC3_Status_TypeDef SHTC3::sendCommand(SHTC3_Commands_TypeDef cmd)
 {
 	uint8_t res = 0;
 
-	_wire->beginTransmission(SHTC3_ADDR_7BIT);
-	_wire->write((((uint16_t)cmd) >> 8));
-	_wire->write((((uint16_t)cmd) & 0x00FF));
-	res = _wire->endTransmission();
+	_traced->beginTransmission(SHTC3_ADDR_7BIT);
+	_traced->write((((uint16_t)cmd) >> 8));
+	_traced->write((((uint16_t)cmd) & 0x00FF));
+	res = _traced->endTransmission();
 
 	if (res)
 	{
@@ -116,6 +117,7 @@ SHTC3_Status_TypeDef SHTC3::begin(TwoWire &wirePort)
 	;
 
 	_wire = &wirePort; // Associate the I2C port
+	_traced = &TracedWire::of(wirePort);
 	// _clkFreq = speed;																	// Associate the desired speed
 
 	// if(_clkFreq > SHTC3_MAX_CLOCK_FREQ)													// Throttle the clock speen
@@ -181,16 +183,16 @@ SHTC3_Status_TypeDef SHTC3::checkID()
 		return exitOp(retval, __FILE__, __LINE__);
 	}
 
-	numBytesRx = _wire->requestFrom((uint8_t)SHTC3_ADDR_7BIT, numBytesRequest);
+	numBytesRx = _traced->requestFrom((uint8_t)SHTC3_ADDR_7BIT, numBytesRequest);
 	if (numBytesRx != numBytesRequest)
 	{
 		exitOp(SHTC3_Status_Error, __FILE__, __LINE__);
 		return SHTC3_Status_Error;
 	}
 
-	uint8_t IDhb = _wire->read();
-	uint8_t IDlb = _wire->read();
-	uint8_t IDcs = _wire->read();
+	uint8_t IDhb = _traced->read();
+	uint8_t IDlb = _traced->read();
+	uint8_t IDcs = _traced->read();
 
 	ID = (((uint16_t)IDhb << 8) | ((uint16_t)IDlb));
 
@@ -311,7 +313,7 @@ SHTC3_Status_TypeDef SHTC3::update()
 	case SHTC3_CMD_CSE_RHF_LPM:
 	case SHTC3_CMD_CSE_TF_NPM:
 	case SHTC3_CMD_CSE_TF_LPM:	   // Address+read will yield an ACK and then clock stretching will occur
-		numBytesRx = _wire->requestFrom((uint8_t)SHTC3_ADDR_7BIT, numBytesRequest);
+		numBytesRx = _traced->requestFrom((uint8_t)SHTC3_ADDR_7BIT, numBytesRequest);
 		break;
 
 	case SHTC3_CMD_CSD_RHF_NPM:
@@ -336,13 +338,13 @@ SHTC3_Status_TypeDef SHTC3::update()
 	case SHTC3_CMD_CSD_RHF_NPM:
 	case SHTC3_CMD_CSD_RHF_LPM:
 		// RH First
-		RHhb = _wire->read();
-		RHlb = _wire->read();
-		RHcs = _wire->read();
+		RHhb = _traced->read();
+		RHlb = _traced->read();
+		RHcs = _traced->read();
 
-		Thb = _wire->read();
-		Tlb = _wire->read();
-		Tcs = _wire->read();
+		Thb = _traced->read();
+		Tlb = _traced->read();
+		Tcs = _traced->read();
 		break;
 
 	case SHTC3_CMD_CSE_TF_NPM:
@@ -350,13 +352,13 @@ SHTC3_Status_TypeDef SHTC3::update()
 	case SHTC3_CMD_CSD_TF_NPM:
 	case SHTC3_CMD_CSD_TF_LPM:
 		// T First
-		Thb = _wire->read();
-		Tlb = _wire->read();
-		Tcs = _wire->read();
+		Thb = _traced->read();
+		Tlb = _traced->read();
+		Tcs = _traced->read();
 
-		RHhb = _wire->read();
-		RHlb = _wire->read();
-		RHcs = _wire->read();
+		RHhb = _traced->read();
+		RHlb = _traced->read();
+		RHcs = _traced->read();
 		break;
 
 	default:
@@ -47,11 +47,14 @@ typedef enum
 	SHTC3_Status_ID_Fail	  // This status means that the ID of the device did not match the format for SHTC3
 } SHTC3_Status_TypeDef;
 
+class TracedWire; // I2C_trace.h in cscore
+
 class SHTC3
 {
 private:
 protected:
 	TwoWire *_wire;
+	TracedWire *_traced;	// I2C trace of _wire, set in begin()
 
 	SHTC3_MeasurementModes_TypeDef _mode;
 
@@ -5,6 +5,8 @@ Reference https://www.ti.com/tool/BQ27XXXSW-LINUX
 Reference https://www.ti.com/lit/ds/symlink/bq27200.pdf
 */
 #include "BQ27200_I2C.h"
+#define I2C_TRACE_INTERPOSE
+#include "I2C_trace.h"
 
 #define BQ27200_ADDR 0x55
 #define R_SERIES 20 // mOhm (measured)
@@ -1,5 +1,7 @@
 
 #include "CS_core.h"
+#define I2C_TRACE_INTERPOSE
+#include "I2C_trace.h"
 
 #define PCA9554_REG_INP 0
 #define PCA9554_REG_OUT 1
@@ -29,10 +31,13 @@ CS_core::CS_core()
  **************************************************************************/
 static void writeRegister(uint8_t i2cAddress, uint8_t reg, uint8_t value)
 {
-  Wire.beginTransmission(i2cAddress);
-  Wire.write((uint8_t)reg);
-  Wire.write((uint8_t)value);
-  Wire.endTransmission();
+  WITH_LOCK(Wire)
+  {
+    Wire.beginTransmission(i2cAddress);
+    Wire.write((uint8_t)reg);
+    Wire.write((uint8_t)value);
+    Wire.endTransmission();
+  }
 }
 
 /***************************************************************************
@@ -42,11 +47,15 @@ static void writeRegister(uint8_t i2cAddress, uint8_t reg, uint8_t value)
  **************************************************************************/
 static uint16_t readRegister(uint8_t i2cAddress, uint8_t reg)
 {
-  Wire.beginTransmission(i2cAddress);
-  Wire.write(reg);
-  Wire.endTransmission();
-  Wire.requestFrom(i2cAddress, (uint8_t)1);
-  return Wire.read();
+  WITH_LOCK(Wire)
+  {
+    Wire.beginTransmission(i2cAddress);
+    Wire.write(reg);
+    Wire.endTransmission();
+    Wire.requestFrom(i2cAddress, (uint8_t)1);
+    return Wire.read();
+  }
+  return 0;
 }
 
 /***************************************************************************
@@ -67,15 +76,15 @@ void CS_core::begin(uint8_t hw_release)
   {
     Wire.begin();
     // Read out default values from the registers to the shadow variables.
-    m_inp = readRegister(GPIO_A, PCA9554_REG_INP);
-    m_out = readRegister(GPIO_A, PCA9554_REG_OUT);
-    m_pol = readRegister(GPIO_A, PCA9554_REG_POL);
-    m_ctrl = readRegister(GPIO_A, PCA9554_REG_CTRL);
-    m_inp = readRegister(GPIO_B, PCA9554_REG_INP);
-    m_out = readRegister(GPIO_B, PCA9554_REG_OUT);
-    m_pol = readRegister(GPIO_B, PCA9554_REG_POL);
-    m_ctrl = readRegister(GPIO_B, PCA9554_REG_CTRL);
+    for (uint8_t i = 0; i < 2; i++)
+    {
+      m_inp[i] = readRegister(GPIO_A + i, PCA9554_REG_INP);
+      m_out[i] = readRegister(GPIO_A + i, PCA9554_REG_OUT);
+      m_pol[i] = readRegister(GPIO_A + i, PCA9554_REG_POL);
+      m_ctrl[i] = readRegister(GPIO_A + i, PCA9554_REG_CTRL);
+    }
 
+    beginTransaction();
     pinMode_ext(GPIO_A, 0, OUTPUT);   //Stat2 Overriden to avoid interrupt noise, they share logic line with interrupt WKP
     pinMode_ext(GPIO_A, 1, OUTPUT);   //Stat1 Overriden to avoid interrupt noise, they share logic line with interrupt WKP
     digitalWrite_ext(GPIO_A, 0, LOW); //Stat2
@@ -90,13 +99,16 @@ void CS_core::begin(uint8_t hw_release)
     pinMode(D5, OUTPUT); //EN_GPS
     pinMode(B0, INPUT);  //SYSTEM-ON_GPS
     pinMode(A7, INPUT);  //NOISE SENSOR
+    commit();
     delay(100);
     
     // Default configuration - everything OFF
+    beginTransaction();
     digitalWrite_ext(GPIO_B, 5, LOW);   //ENABLE3V OFF
     digitalWrite_ext(GPIO_B, 6, HIGH);  //ENABLE5V OFF
     digitalWrite_ext(GPIO_A, 4, LOW);   //EN_HEATER OFF
     digitalWrite_ext(GPIO_A, 5, LOW);   //EN_PW_OPC OFF
+    commit();
     digitalWrite(D6, LOW);              //EN_GPS OFF
     digitalWrite(A0, HIGH);             //ONOFF_GPS OFF
     break;
@@ -138,6 +150,69 @@ void CS_core::begin(uint8_t hw_release)
   }
 }
 
+/***************************************************************************
+ *
+ * Transactions. Nested calls are allowed, the registers are written when
+ * the outermost transaction is committed.
+ *
+ **************************************************************************/
+void CS_core::beginTransaction()
+{
+  m_transaction++;
+}
+
+void CS_core::commit()
+{
+  if (m_transaction == 0 || --m_transaction > 0)
+  {
+    return;
+  }
+
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    for (uint8_t reg = PCA9554_REG_OUT; reg <= PCA9554_REG_CTRL; reg++)
+    {
+      if (m_dirty[i] & (1 << reg))
+      {
+        writeShadow(GPIO_A + i, reg);
+      }
+    }
+    m_dirty[i] = 0;
+  }
+  m_inp_valid = 0;
+}
+
+/***************************************************************************
+ *
+ * Writes a shadow register to the expander, or defers it to commit()
+ *
+ **************************************************************************/
+void CS_core::writeShadow(uint8_t address, uint8_t reg)
+{
+  uint8_t i = address - GPIO_A;
+
+  if (m_transaction > 0)
+  {
+    m_dirty[i] |= (1 << reg);
+    return;
+  }
+
+  switch (reg)
+  {
+  case PCA9554_REG_OUT:
+    writeRegister(address, reg, m_out[i]);
+    break;
+  case PCA9554_REG_POL:
+    writeRegister(address, reg, m_pol[i]);
+    break;
+  case PCA9554_REG_CTRL:
+    writeRegister(address, reg, m_ctrl[i]);
+    break;
+  default:
+    break;
+  }
+}
+
 /***************************************************************************
  *
  * Sets the desired pin mode
@@ -154,18 +229,18 @@ boolean CS_core::pinMode_ext(uint8_t address, uint8_t pin, uint8_t mode)
   // Calculate the new control register value
   if (mode == OUTPUT)
   {
-    m_ctrl &= ~pinNum2bitNum[pin];
+    m_ctrl[address - GPIO_A] &= ~pinNum2bitNum[pin];
   }
   else if (mode == INPUT)
   {
-    m_ctrl |= pinNum2bitNum[pin];
+    m_ctrl[address - GPIO_A] |= pinNum2bitNum[pin];
   }
   else
   {
     return false;
   }
 
-  writeRegister(address, PCA9554_REG_CTRL, m_ctrl);
+  writeShadow(address, PCA9554_REG_CTRL);
 
   return true;
 }
@@ -185,14 +260,14 @@ boolean CS_core::digitalWrite_ext(uint8_t address, uint8_t pin, boolean val)
 
   if (val == HIGH)
   {
-    m_out |= pinNum2bitNum[pin];
+    m_out[address - GPIO_A] |= pinNum2bitNum[pin];
   }
   else
   {
-    m_out &= ~pinNum2bitNum[pin];
+    m_out[address - GPIO_A] &= ~pinNum2bitNum[pin];
   }
 
-  writeRegister(address, PCA9554_REG_OUT, m_out);
+  writeShadow(address, PCA9554_REG_OUT);
   return true;
 }
 
@@ -207,7 +282,18 @@ boolean CS_core::digitalRead_ext(uint8_t address, uint8_t pin)
 {
   //Serial.print("Debug: "); Serial.println(readRegister(address, PCA9554_REG_INP));
   //Serial.print("Pin numbrt"); Serial.println(pinNum2bitNum[pin]);
-  return (readRegister(address, PCA9554_REG_INP) & (pinNum2bitNum[pin]));
+  uint8_t i = address - GPIO_A;
+
+  // Inside a transaction the input register is read once and reused
+  if (m_transaction == 0 || !(m_inp_valid & (1 << i)))
+  {
+    m_inp[i] = readRegister(address, PCA9554_REG_INP);
+    if (m_transaction > 0)
+    {
+      m_inp_valid |= (1 << i);
+    }
+  }
+  return (m_inp[i] & (pinNum2bitNum[pin]));
 }
 
 /***************************************************************************
@@ -226,18 +312,18 @@ boolean CS_core::pinPolarity(uint8_t address, uint8_t pin, uint8_t polarity)
 
   if (polarity == INVERTED)
   {
-    m_pol |= pinNum2bitNum[pin];
+    m_pol[address - GPIO_A] |= pinNum2bitNum[pin];
   }
   else if (polarity == NORMAL)
   {
-    m_pol &= ~pinNum2bitNum[pin];
+    m_pol[address - GPIO_A] &= ~pinNum2bitNum[pin];
   }
   else
   {
     return false;
   }
 
-  writeRegister(address, PCA9554_REG_POL, m_pol);
+  writeShadow(address, PCA9554_REG_POL);
 
   return true;
 }
@@ -506,10 +592,12 @@ void CS_core::enableALL(bool command)
     }
     else
     {
+      beginTransaction();
       digitalWrite_ext(GPIO_B, 5, LOW);  //ENABLE3V OFF
       digitalWrite_ext(GPIO_B, 6, HIGH); //ENABLE5V OFF
       digitalWrite_ext(GPIO_A, 4, LOW);  //EN_HEATER OFF
       digitalWrite_ext(GPIO_A, 5, LOW);  //EN_PW_OPC OFF
+      commit();
       //digitalWrite(C4, LOW);             //EN_GPS OFF
       digitalWrite(A0, HIGH);            //ONOFF_GPS OFF
       Log.info("Deactivate ALL");
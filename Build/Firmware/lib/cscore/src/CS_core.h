@@ -54,14 +54,24 @@ public:
   uint8_t isCharging();
   uint8_t isCharged();
 
+  // Expander transactions: between beginTransaction() and commit() pin changes only update
+  // the shadow registers and inputs are read once, commit() writes each changed register once
+  void beginTransaction();
+  void commit();
+
 private:
   CS_core();
   static CS_core* _instance;
-  uint8_t m_inp;
-  uint8_t m_out;
-  uint8_t m_pol;
-  uint8_t m_ctrl;
+  // Shadow registers, one per expander (index 0 = GPIO_A, 1 = GPIO_B)
+  uint8_t m_inp[2];
+  uint8_t m_out[2];
+  uint8_t m_pol[2];
+  uint8_t m_ctrl[2];
+  uint8_t m_dirty[2] = {0, 0};        // registers to write on commit, bit n = register n
+  uint8_t m_inp_valid = 0;            // expanders whose input snapshot is valid in this transaction
+  uint8_t m_transaction = 0;          // nesting depth
   uint8_t hw_version;
+  void writeShadow(uint8_t address, uint8_t reg);
   boolean pinMode_ext(uint8_t address, uint8_t pin, uint8_t mode);
   boolean pinPolarity(uint8_t address, uint8_t pin, uint8_t polarity);
   boolean digitalWrite_ext(uint8_t address, uint8_t pin, boolean val);
@@ -0,0 +1,178 @@
+#include "I2C_trace.h"
+
+I2CTrace *I2CTrace::_instance = nullptr;
+
+/**
+ * Constructor.
+ */
+I2CTrace::I2CTrace()
+{
+}
+
+/***************************************************************************
+ *
+ * Adds one transaction to the slot of the address. status is one of
+ * I2C_OK, I2C_NACK or I2C_TIMEOUT, ticks the System.ticks() spent on it.
+ *
+ **************************************************************************/
+void I2CTrace::record(uint8_t address, uint16_t bytes, uint8_t status, uint32_t ticks)
+{
+  SINGLE_THREADED_BLOCK()
+  {
+    Slot *slot = nullptr;
+    for (uint8_t i = 0; i < slot_count; i++)
+    {
+      if (slots[i].address == address)
+      {
+        slot = &slots[i];
+        break;
+      }
+    }
+    if (slot == nullptr)
+    {
+      if (slot_count == I2C_TRACE_SLOTS)
+      {
+        dropped++;
+        return;
+      }
+      slot = &slots[slot_count++];
+      memset(slot, 0, sizeof(Slot));
+      slot->address = address;
+    }
+    if (status != I2C_OK)
+      total_errors++;
+    slot->transactions++;
+    slot->bytes += bytes;
+    if (status == I2C_NACK)
+      slot->nacks++;
+    else if (status == I2C_TIMEOUT)
+      slot->timeouts++;
+    slot->ticks += ticks;
+  }
+}
+
+/***************************************************************************
+ *
+ * Clears every counter, the address slots are kept
+ *
+ **************************************************************************/
+void I2CTrace::reset()
+{
+  SINGLE_THREADED_BLOCK()
+  {
+    for (uint8_t i = 0; i < slot_count; i++)
+    {
+      uint8_t address = slots[i].address;
+      memset(&slots[i], 0, sizeof(Slot));
+      slots[i].address = address;
+    }
+    dropped = 0;
+  }
+}
+
+/***************************************************************************
+ *
+ * One entry per address, separated by ';' so it fits in one CSV column:
+ * address(hex):transactions/bytes/nacks/timeouts/time_on_bus(us)
+ *
+ **************************************************************************/
+String I2CTrace::report(bool reset_counters)
+{
+  Slot copy[I2C_TRACE_SLOTS];
+  uint8_t count;
+  SINGLE_THREADED_BLOCK()
+  {
+    count = slot_count;
+    memcpy(copy, slots, sizeof(Slot) * count);
+  }
+  if (reset_counters)
+    reset();
+
+  String response = "";
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (copy[i].transactions == 0)
+      continue;
+    if (response.length())
+      response += ";";
+    response += String::format("%02x:%lu/%lu/%u/%u/%lu", copy[i].address, copy[i].transactions, copy[i].bytes,
+                               copy[i].nacks, copy[i].timeouts, copy[i].ticks / System.ticksPerMicrosecond());
+  }
+  return response.length() ? response : "na";
+}
+
+TracedWire &TracedWire::global()
+{
+  static TracedWire traced(Wire);
+  return traced;
+}
+
+/***************************************************************************
+ *
+ * Interposer for a driver port, a port other than Wire gets its own
+ * tracer on first use. Drivers call this once in begin() and keep it.
+ *
+ **************************************************************************/
+static TracedWire *traced_ports = nullptr;
+
+TracedWire &TracedWire::of(TwoWire &port)
+{
+  if (&port == &global().wire)
+    return global();
+  for (TracedWire *traced = traced_ports; traced; traced = traced->next)
+    if (&traced->wire == &port)
+      return *traced;
+
+  // Allocated outside the block, malloc must not run with the threads stopped
+  TracedWire *added = new TracedWire(port);
+  TracedWire *found = nullptr;
+  SINGLE_THREADED_BLOCK()
+  {
+    for (TracedWire *traced = traced_ports; traced && !found; traced = traced->next)
+      if (&traced->wire == &port)
+        found = traced;
+    if (!found)
+    {
+      added->next = traced_ports;
+      traced_ports = added;
+      found = added;
+      added = nullptr;
+    }
+  }
+  delete added;
+  return *found;
+}
+
+/***************************************************************************
+ *
+ * endTransmission() codes 2 and 3 are NACKs on the address or on the data,
+ * any other error is a bus timeout/arbitration failure
+ *
+ **************************************************************************/
+uint8_t TracedWire::endTransmission(uint8_t stop)
+{
+  uint32_t start = System.ticks();
+  uint8_t result = wire.endTransmission(stop);
+  uint8_t status = I2CTrace::I2C_OK;
+  if (result == 2 || result == 3)
+    status = I2CTrace::I2C_NACK;
+  else if (result != 0)
+    status = I2CTrace::I2C_TIMEOUT;
+  I2CTrace::instance().record(tx_address, tx_bytes, status, System.ticks() - start);
+  wire.unlock(); // taken by beginTransmission()
+  return result;
+}
+
+/***************************************************************************
+ *
+ * Fewer bytes than requested means the device did not acknowledge
+ *
+ **************************************************************************/
+uint8_t TracedWire::requestFrom(int address, int quantity, int stop)
+{
+  uint32_t start = System.ticks();
+  uint8_t received = wire.requestFrom((uint8_t)address, (uint8_t)quantity, (uint8_t)stop);
+  I2CTrace::instance().record(address, received, received < quantity ? I2CTrace::I2C_NACK : I2CTrace::I2C_OK,
+                              System.ticks() - start);
+  return received;
+}
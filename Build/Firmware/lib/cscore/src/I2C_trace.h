@@ -0,0 +1,116 @@
+#pragma once
+
+#include "Particle.h"
+#include <Wire.h>
+
+#define I2C_TRACE_SLOTS 16 // 7-bit addresses tracked, later addresses are counted as dropped
+
+/***************************************************************************
+ *
+ * Per address I2C counters, filled by TracedWire or by drivers that hold
+ * their own TwoWire pointer through record()
+ *
+ **************************************************************************/
+class I2CTrace
+{
+public:
+  static I2CTrace &instance()
+  {
+    if (!_instance)
+    {
+      _instance = new I2CTrace();
+    }
+    return *_instance;
+  }
+
+  enum Status
+  {
+    I2C_OK,
+    I2C_NACK,
+    I2C_TIMEOUT
+  };
+
+  void record(uint8_t address, uint16_t bytes, uint8_t status, uint32_t ticks);
+  String report(bool reset_counters);
+  void reset();
+  uint32_t errors() { return total_errors; } // NACKs and timeouts since boot
+
+private:
+  I2CTrace();
+  static I2CTrace *_instance;
+
+  struct Slot
+  {
+    uint8_t address;
+    uint32_t transactions;
+    uint32_t bytes;
+    uint16_t nacks;
+    uint16_t timeouts;
+    uint32_t ticks; // time on bus, System.ticks()
+  };
+  Slot slots[I2C_TRACE_SLOTS];
+  uint8_t slot_count = 0;
+  uint32_t dropped = 0;
+  uint32_t total_errors = 0;
+};
+
+/***************************************************************************
+ *
+ * Wire interposer. Forwards the calls used by the drivers to TwoWire and
+ * records every endTransmission()/requestFrom() in I2CTrace.
+ * A driver using the global Wire opts in by defining I2C_TRACE_INTERPOSE
+ * before including this file, every use of Wire in that translation unit
+ * is then traced. Drivers holding a TwoWire pointer keep the tracer of
+ * their port from of(), one tracer per port.
+ * beginTransmission() takes the port lock and endTransmission() releases
+ * it, so the address and byte count of a transaction belong to the thread
+ * that started it.
+ *
+ **************************************************************************/
+class TracedWire
+{
+public:
+  TracedWire(TwoWire &wire) : wire(wire) {}
+
+  void begin() { wire.begin(); }
+  void beginTransmission(int address)
+  {
+    wire.lock();
+    tx_address = address;
+    tx_bytes = 0;
+    wire.beginTransmission(address);
+  }
+  size_t write(uint8_t data)
+  {
+    size_t n = wire.write(data);
+    tx_bytes += n;
+    return n;
+  }
+  size_t write(int data) { return write((uint8_t)data); }
+  size_t write(const uint8_t *data, size_t quantity)
+  {
+    size_t n = wire.write(data, quantity);
+    tx_bytes += n;
+    return n;
+  }
+  uint8_t endTransmission(uint8_t stop = true);
+  uint8_t requestFrom(int address, int quantity, int stop = true);
+  int available() { return wire.available(); }
+  int read() { return wire.read(); }
+  bool lock() { return wire.lock(); }
+  bool unlock() { return wire.unlock(); }
+
+  static TracedWire &global();
+  static TracedWire &of(TwoWire &port);
+
+private:
+  TwoWire &wire;
+  TracedWire *next = nullptr; // next port traced by of()
+  uint8_t tx_address = 0;     // written under the port lock
+  uint16_t tx_bytes = 0;
+};
+
+#ifdef I2C_TRACE_INTERPOSE
+#undef Wire
+#define Wire TracedWire::global()
+#endif
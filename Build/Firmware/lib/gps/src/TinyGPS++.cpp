@@ -27,9 +27,6 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <ctype.h>
 #include <stdlib.h>
 
-#define _GPRMCterm   "GPRMC"
-#define _GPGGAterm   "GPGGA"
-
 // Stuff included in Ardiuno but not Particle:
 #ifndef SPARK_WIRING_ARDUINO_CONSTANTS_H
 double radians(double deg) {
@@ -52,12 +49,15 @@ TinyGPSPlus::TinyGPSPlus()
   ,  curTermNumber(0)
   ,  curTermOffset(0)
   ,  sentenceHasFix(false)
+  ,  filteredMode(false)
+  ,  skipSentence(false)
   ,  customElts(0)
   ,  customCandidates(0)
   ,  encodedCharCount(0)
   ,  sentencesWithFixCount(0)
   ,  failedChecksumCount(0)
   ,  passedChecksumCount(0)
+  ,  skippedSentenceCount(0)
 {
   term[0] = '\0';
 }
@@ -70,6 +70,10 @@ bool TinyGPSPlus::encode(char c)
 {
   ++encodedCharCount;
 
+  // In filtered mode, drop everything up to the start of the next sentence
+  if (skipSentence && c != '$')
+    return false;
+
   switch(c)
   {
   case ',': // term terminators
@@ -98,6 +102,7 @@ bool TinyGPSPlus::encode(char c)
     curSentenceType = GPS_SENTENCE_OTHER;
     isChecksumTerm = false;
     sentenceHasFix = false;
+    skipSentence = false;
     return false;
 
   default: // ordinary characters
@@ -105,6 +110,16 @@ bool TinyGPSPlus::encode(char c)
       term[curTermOffset++] = c;
     if (!isChecksumTerm)
       parity ^= c;
+    // The sentence type is known after the first five characters (talker + type)
+    if (filteredMode && curTermNumber == 0 && curTermOffset == 5)
+    {
+      term[curTermOffset] = 0;
+      if (sentenceType(term) == GPS_SENTENCE_OTHER && !hasCustomSentence(term))
+      {
+        skipSentence = true;
+        ++skippedSentenceCount;
+      }
+    }
     return false;
   }
 
@@ -242,12 +257,7 @@ bool TinyGPSPlus::endOfTermHandler()
   // the first term determines the sentence type
   if (curTermNumber == 0)
   {
-    if (!strcmp(term, _GPRMCterm) || !strcmp(term, "GNRMC"))
-      curSentenceType = GPS_SENTENCE_GPRMC;
-    else if (!strcmp(term, _GPGGAterm) ||!strcmp(term, "GNGGA"))
-      curSentenceType = GPS_SENTENCE_GPGGA;
-    else
-      curSentenceType = GPS_SENTENCE_OTHER;
+    curSentenceType = sentenceType(term);
 
     // Any custom candidates of this sentence type?
     for (customCandidates = customElts; customCandidates != NULL && strcmp(customCandidates->sentenceName, term) < 0; customCandidates = customCandidates->next);
@@ -317,6 +327,28 @@ bool TinyGPSPlus::endOfTermHandler()
   return false;
 }
 
+// Maps a sentence name to its type. Only the GP (GPS) and GN (multi-GNSS) talkers are decoded.
+uint8_t TinyGPSPlus::sentenceType(const char *term)
+{
+  if (term[0] != 'G' || (term[1] != 'P' && term[1] != 'N') || term[5] != 0)
+    return GPS_SENTENCE_OTHER;
+  if (term[2] == 'R' && term[3] == 'M' && term[4] == 'C')
+    return GPS_SENTENCE_GPRMC;
+  if (term[2] == 'G' && term[3] == 'G' && term[4] == 'A')
+    return GPS_SENTENCE_GPGGA;
+  return GPS_SENTENCE_OTHER;
+}
+
+// Returns true if a custom element was registered for this sentence name (prefix match,
+// as the name may still be incomplete when called from the filter)
+bool TinyGPSPlus::hasCustomSentence(const char *term)
+{
+  for (TinyGPSCustom *p = customElts; p != NULL; p = p->next)
+    if (strncmp(p->sentenceName, term, strlen(term)) == 0)
+      return true;
+  return false;
+}
+
 /* static */
 double TinyGPSPlus::distanceBetween(double lat1, double long1, double lat2, double long2)
 {
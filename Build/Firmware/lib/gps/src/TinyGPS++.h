@@ -787,6 +787,20 @@ public:
 	 */
 	bool encode(char c);
 
+	/**
+	 * @brief Only parse the sentences that TinyGPS++ decodes (RMC and GGA) or that have a custom element
+	 *
+	 * In filtered mode the sentence type is recognized from the first five characters after the '$'
+	 * and every other sentence (GSV, GSA, VTG, ...) is skipped up to the next '$' without running
+	 * the term or checksum handlers. Skipped sentences are counted in sentencesSkipped().
+	 */
+	void setFilteredMode(bool enable) { filteredMode = enable; }
+
+	/**
+	 * @brief Returns true if filtered mode is enabled
+	 */
+	bool isFilteredMode() const { return filteredMode; }
+
 	/**
 	 * @brief operator<< can be used instead of encode
 	 */
@@ -842,6 +856,11 @@ public:
 	 */
 	uint32_t passedChecksum()   const { return passedChecksumCount; }
 
+	/**
+	 * @brief Return the number of sentences skipped in filtered mode
+	 */
+	uint32_t sentencesSkipped() const { return skippedSentenceCount; }
+
 private:
 	enum {GPS_SENTENCE_GPGGA, GPS_SENTENCE_GPRMC, GPS_SENTENCE_OTHER};
 
@@ -857,6 +876,8 @@ private:
 	uint8_t curTermNumber;
 	uint8_t curTermOffset;
 	bool sentenceHasFix;
+	bool filteredMode;
+	bool skipSentence;
 
 	// custom element support
 	friend class TinyGPSCustom;
@@ -869,10 +890,13 @@ private:
 	uint32_t sentencesWithFixCount;
 	uint32_t failedChecksumCount;
 	uint32_t passedChecksumCount;
+	uint32_t skippedSentenceCount;
 
 	// internal utilities
 	int fromHex(char a);
 	bool endOfTermHandler();
+	uint8_t sentenceType(const char *term);
+	bool hasCustomSentence(const char *term);
 };
 
 #endif // def(__TinyGPSPlus_h)
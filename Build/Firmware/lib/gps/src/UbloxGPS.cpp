@@ -656,6 +656,119 @@ bool Ublox::enableExtIntBackupSync(bool enable, unsigned long timeout) {
 	return (reason == UbloxMessageHandler::Reason::COMPLETE);
 }
 
+void Ublox::setPowerMode(PowerMode mode, UbloxCommandCallback callback, unsigned long timeout) {
+	UbloxCommand<2> cmd;
+
+	cmd.setClassId(0x06, 0x11); // CFG-RXM
+	cmd.appendU1(0x08);	// reserved1, must be 8
+	cmd.appendU1((uint8_t)mode); // lpMode
+
+	configCommand(&cmd, callback, timeout);
+}
+
+void Ublox::setMeasurementRate(uint16_t measRateMs, uint16_t navRate, UbloxCommandCallback callback, unsigned long timeout) {
+	UbloxCommand<6> cmd;
+
+	cmd.setClassId(0x06, 0x08); // CFG-RATE
+	cmd.appendU2(measRateMs);
+	cmd.appendU2(navRate);
+	cmd.appendU2(0x0001); // timeRef = GPS time
+
+	configCommand(&cmd, callback, timeout);
+}
+
+void Ublox::setPowerSaveConfig(uint32_t updatePeriodMs, uint32_t searchPeriodMs, bool cyclicTracking, UbloxCommandCallback callback, unsigned long timeout) {
+
+	configGetSetValue(0x06, 0x3B, [this, callback, updatePeriodMs, searchPeriodMs, cyclicTracking](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		UBLOX_DEBUG_VERBOSE(("setPowerSaveConfig reason=%d", (int) reason));
+
+		if (reason == UbloxMessageHandler::Reason::UPDATE) {
+			uint32_t flags = cmd->getU4(0x04);
+			flags &= ~0x00060000; // mode, bits 17..18
+			if (cyclicTracking) {
+				flags |= 0x00020000;
+			}
+			cmd->setU4(0x04, flags);
+			cmd->setU4(0x08, updatePeriodMs);
+			cmd->setU4(0x0C, searchPeriodMs);
+			return;
+		}
+
+		if (callback) {
+			callback(cmd, reason);
+		}
+	}, timeout);
+}
+
+void Ublox::pollNavigationDatabase(UbloxCommandCallback callback, unsigned long quietTimeout) {
+	UbloxMessageHandler *handler = new UbloxMessageHandler();
+
+	handler->classFilter = 0x13; // MGA
+	handler->idFilter = 0x80; // DBD
+	handler->removeAndDelete = false;
+	handler->timeout = System.millis() + quietTimeout;
+	handler->handler = [handler, callback, quietTimeout](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		if (reason == UbloxMessageHandler::Reason::DATA) {
+			// More database messages are likely to follow, push the timeout back
+			handler->timeout = System.millis() + quietTimeout;
+			callback(cmd, reason);
+			return;
+		}
+
+		// No message for quietTimeout, the dump is complete
+		UBLOX_DEBUG_VERBOSE(("pollNavigationDatabase complete"));
+		handler->removeAndDelete = true;
+		callback(NULL, UbloxMessageHandler::Reason::COMPLETE);
+	};
+
+	addHandler(handler);
+
+	UbloxCommand<0> cmd;
+
+	cmd.setClassId(0x13, 0x80); // MGA-DBD poll
+	sendCommand(&cmd);
+}
+
+void Ublox::sendTimeAiding(time_t utc, uint16_t accuracySec) {
+	struct tm *tm = gmtime(&utc);
+
+	UbloxCommand<24> cmd;
+
+	cmd.setClassId(0x13, 0x40); // MGA-INI-TIME_UTC
+	cmd.appendU1(0x10); // type
+	cmd.appendU1(0x00); // version
+	cmd.appendU1(0x00); // ref = on receipt of message
+	cmd.appendI1(-128); // leapSecs unknown
+	cmd.appendU2(tm->tm_year + 1900);
+	cmd.appendU1(tm->tm_mon + 1);
+	cmd.appendU1(tm->tm_mday);
+	cmd.appendU1(tm->tm_hour);
+	cmd.appendU1(tm->tm_min);
+	cmd.appendU1(tm->tm_sec);
+	cmd.appendU1(0); // reserved1
+	cmd.appendU4(0); // ns
+	cmd.appendU2(accuracySec); // tAccS
+	cmd.appendU2(0); // reserved2
+	cmd.appendU4(0); // tAccNs
+
+	sendCommand(&cmd);
+}
+
+void Ublox::sendPositionAiding(double lat, double lon, float altMeters, float accuracyMeters) {
+	UbloxCommand<20> cmd;
+
+	cmd.setClassId(0x13, 0x40); // MGA-INI-POS_LLH
+	cmd.appendU1(0x01); // type
+	cmd.appendU1(0x00); // version
+	cmd.appendU2(0); // reserved1
+	cmd.appendI4((int32_t)(lat * 1e7));
+	cmd.appendI4((int32_t)(lon * 1e7));
+	cmd.appendI4((int32_t)(altMeters * 100)); // cm
+	cmd.appendU4((uint32_t)(accuracyMeters * 100)); // cm
+
+	sendCommand(&cmd);
+}
+
 
 UbloxAssistNow *UbloxAssistNow::instance = 0;
 static const char *ASSIST_NOW_EVENT_NAME = "AssistNow";
@@ -671,6 +784,14 @@ UbloxAssistNow::~UbloxAssistNow() {
 void UbloxAssistNow::setup() {
 }
 
+UbloxAssistNow &UbloxAssistNow::withOfflineSource(std::function<int(uint8_t *buf, size_t len)> offlineSource) {
+	this->offlineSource = offlineSource;
+	if (!download) {
+		stateHandler = &UbloxAssistNow::stateStartOffline;
+	}
+	return *this;
+}
+
 void UbloxAssistNow::loop() {
 	if (stateHandler) {
 		stateHandler(this);
@@ -897,6 +1018,11 @@ void UbloxAssistNow::stateReadResponse() {
 }
 
 void UbloxAssistNow::stateSendToGPS() {
+	if (offlineSource && (download->contentLength - download->bufferOffset) < 6) {
+		// Not enough data left for a message header, read the next chunk
+		stateHandler = &UbloxAssistNow::stateReadOffline;
+		return;
+	}
 	if (download->bufferOffset >= download->contentLength) {
 		UBLOX_DEBUG(("Done sending aiding data to GPS!"));
 		stateHandler = &UbloxAssistNow::stateDone;
@@ -924,6 +1050,11 @@ void UbloxAssistNow::stateSendToGPS() {
 	memmove(&payloadLen, &download->buffer[download->bufferOffset + 4], 2);
 	
 	uint16_t msgLen = payloadLen + 8;
+	if (offlineSource && (download->bufferOffset + msgLen) > download->contentLength && msgLen <= download->bufferSize) {
+		// Message continues in the next chunk
+		stateHandler = &UbloxAssistNow::stateReadOffline;
+		return;
+	}
 	if ((download->bufferOffset + msgLen) > download->contentLength) {
 		UBLOX_DEBUG(("payloadLen of %u seems to be corrupted", payloadLen));
 		stateHandler = &UbloxAssistNow::stateDone;
@@ -1026,6 +1157,51 @@ void UbloxAssistNow::stateSendToGPS() {
 	download->bufferOffset += msgLen;
 }
 
+void UbloxAssistNow::stateStartOffline() {
+	if (AssetTrackerBase::getInstance()->gpsFix()) {
+		UBLOX_DEBUG(("Already have GPS fix, skipping offline AssistNow"));
+		stateHandler = &UbloxAssistNow::stateDone;
+		return;
+	}
+
+	download = new AssistNowDownload();
+	if (!download || !download->alloc(offlineBufferSize)) {
+		UBLOX_DEBUG(("failed to allocate AssistNowDownload"));
+		stateHandler = &UbloxAssistNow::stateDone;
+		return;
+	}
+
+	if (Time.isValid() && Ublox::getInstance()) {
+		Ublox::getInstance()->sendTimeAiding(Time.now(), 2);
+	}
+
+	download->bufferOffset = 0;
+	download->contentLength = 0;
+	stateHandler = &UbloxAssistNow::stateReadOffline;
+}
+
+void UbloxAssistNow::stateReadOffline() {
+	size_t remaining = download->contentLength - download->bufferOffset;
+	if (remaining > 0) {
+		memmove(download->buffer, &download->buffer[download->bufferOffset], remaining);
+	}
+
+	int count = offlineSource(&download->buffer[remaining], download->bufferSize - remaining);
+	if (count <= 0) {
+		if (remaining > 0) {
+			UBLOX_DEBUG(("offline data truncated, %u bytes not sent", remaining));
+		}
+		UBLOX_DEBUG(("Done sending offline aiding data to GPS!"));
+		stateHandler = &UbloxAssistNow::stateDone;
+		return;
+	}
+	UBLOX_DEBUG_VERBOSE(("read %d bytes of offline aiding data", count));
+
+	download->contentLength = remaining + count;
+	download->bufferOffset = 0;
+	stateHandler = &UbloxAssistNow::stateSendToGPS;
+}
+
 void UbloxAssistNow::stateDone() {
 	if (download) {
 		delete download;
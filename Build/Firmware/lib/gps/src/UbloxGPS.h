@@ -769,13 +769,105 @@ public:
 	 */
 	void resetReceiver(StartType startType, ResetMode resetMode = ResetMode::CONTROLLED_SOFTWARE_RESET);
 
+	/**
+	 * @brief Constants for the receiver power mode used by setPowerMode (UBX-CFG-RXM lpMode)
+	 */
+	enum class PowerMode {
+		CONTINUOUS = 0,		//!< Continuous tracking, highest power
+		POWER_SAVE = 1		//!< Power Save Mode, configured with setPowerSaveConfig
+	};
+
+	/**
+	 * @brief Selects continuous or power save mode (UBX-CFG-RXM)
+	 * 
+	 * @param mode CONTINUOUS or POWER_SAVE
+	 * 
+	 * @param callback Called with ACK, NACK or TIMEOUT. May be NULL.
+	 */
+	void setPowerMode(PowerMode mode, UbloxCommandCallback callback = NULL, unsigned long timeout = 5000);
+
+	/**
+	 * @brief Sets the navigation solution rate (UBX-CFG-RATE)
+	 * 
+	 * @param measRateMs Time between GNSS measurements in milliseconds (1000 = 1 Hz)
+	 * 
+	 * @param navRate Number of measurements for each navigation solution (typically 1)
+	 * 
+	 * @param callback Called with ACK, NACK or TIMEOUT. May be NULL.
+	 */
+	void setMeasurementRate(uint16_t measRateMs, uint16_t navRate = 1, UbloxCommandCallback callback = NULL, unsigned long timeout = 5000);
+
+	/**
+	 * @brief Configures Power Save Mode (UBX-CFG-PM2)
+	 * 
+	 * @param updatePeriodMs Time between position fixes in milliseconds (0 = continuous)
+	 * 
+	 * @param searchPeriodMs Time between acquisition attempts when the receiver can't get a fix
+	 * 
+	 * @param cyclicTracking true for cyclic tracking operation, false for ON/OFF operation
+	 * 
+	 * The current configuration is read from the receiver first, so the other PM2 settings
+	 * are preserved. Takes effect once POWER_SAVE is selected with setPowerMode.
+	 */
+	void setPowerSaveConfig(uint32_t updatePeriodMs, uint32_t searchPeriodMs, bool cyclicTracking, UbloxCommandCallback callback, unsigned long timeout = 5000);
+
+	/**
+	 * @brief Stops the GNSS engine, keeping the receiver responsive on I2C/serial
+	 * 
+	 * This is a controlled GNSS stop (UBX-CFG-RST resetMode 0x08). The receiver keeps its
+	 * configuration and aiding data, so startGNSS() does a hot start if possible.
+	 */
+	void stopGNSS() { resetReceiver(StartType::HOT, ResetMode::CONTROLLED_GNSS_STOP); };
+
+	/**
+	 * @brief Starts the GNSS engine after stopGNSS() (UBX-CFG-RST resetMode 0x09)
+	 */
+	void startGNSS() { resetReceiver(StartType::HOT, ResetMode::CONTROLLED_GNSS_START); };
+
+	/**
+	 * @brief Polls the navigation database (UBX-MGA-DBD)
+	 * 
+	 * @param callback Called with DATA for each database message, then with COMPLETE (and a NULL cmd)
+	 * once no further message has arrived for quietTimeout milliseconds.
+	 * 
+	 * The receiver answers the poll with a series of MGA-DBD messages and no terminating message,
+	 * so the end of the dump is detected by the quiet period. Each cmd passed with DATA is a complete
+	 * UBX message (getBuffer(), getSendLength()) that can be stored as-is and sent back to the receiver
+	 * later to restore its ephemeris, almanac and last position.
+	 */
+	void pollNavigationDatabase(UbloxCommandCallback callback, unsigned long quietTimeout = 1000);
+
+	/**
+	 * @brief Sends UTC time aiding to the receiver (UBX-MGA-INI-TIME_UTC)
+	 * 
+	 * @param utc The current time as a Unix timestamp
+	 * 
+	 * @param accuracySec Accuracy of utc in seconds
+	 * 
+	 * Should be sent before the navigation database and position aiding.
+	 */
+	void sendTimeAiding(time_t utc, uint16_t accuracySec);
+
+	/**
+	 * @brief Sends an approximate position to the receiver (UBX-MGA-INI-POS_LLH)
+	 * 
+	 * @param lat Latitude in degrees
+	 * 
+	 * @param lon Longitude in degrees
+	 * 
+	 * @param altMeters Altitude above the ellipsoid in meters
+	 * 
+	 * @param accuracyMeters Accuracy of the position in meters
+	 */
+	void sendPositionAiding(double lat, double lon, float altMeters, float accuracyMeters);
+
 	/**
 	 * @brief Get the singleton instance of this class
 	 */
 	static Ublox *getInstance() { return instance; };
 
 protected:
-	UbloxCommand<100> incomingCommand;
+	UbloxCommand<180> incomingCommand; //!< Sized for the largest MGA-DBD navigation database message
 	
 	std::deque<UbloxCommandBase *> commandsToHandle; 
 	std::vector<UbloxMessageHandler*> handlers;  	//!< Vector of message handler objects, contains filter and callback function to handle incoming messages
@@ -845,6 +937,22 @@ public:
 	 */
 	UbloxAssistNow &withDisableLocation() { this->disableLocation = true; return *this; };
 
+	/**
+	 * @brief Loads aiding data from a local source instead of the u-blox AssistNow server
+	 * 
+	 * @param offlineSource Function that fills buf with up to len bytes of pre-staged aiding data
+	 * (AssistNow Offline or Autonomous, raw UBX messages) and returns the number of bytes read,
+	 * or 0 at the end of the data.
+	 * 
+	 * The data is read in chunks and streamed to the GPS one message at a time by stateSendToGPS,
+	 * so it can be much larger than the download buffer. No cloud connection is used. If the
+	 * time is valid, UTC time aiding is sent first as AssistNow Offline data requires it.
+	 * 
+	 * Calling this again once the previous data has been sent restarts the injection, for
+	 * example after waking from sleep.
+	 */
+	UbloxAssistNow &withOfflineSource(std::function<int(uint8_t *buf, size_t len)> offlineSource);
+
 	/**
 	 * @brief Call from main application setup. Required!
 	 */
@@ -927,6 +1035,26 @@ protected:
 	 */ 
 	void stateSendToGPS();
 
+	/**
+	 * @brief State machine handler for starting an offline injection (internal)
+	 * 
+	 * Goes to stateDone if the GPS already has a fix, otherwise allocates the buffer and sends
+	 * time aiding.
+	 * 
+	 * Next state: stateReadOffline or stateDone.
+	 */ 
+	void stateStartOffline();
+
+	/**
+	 * @brief State machine handler for reading the next chunk of offline data (internal)
+	 * 
+	 * Any part of a message left over from the previous chunk is moved to the beginning
+	 * of the buffer and the rest of the buffer is filled from offlineSource.
+	 * 
+	 * Next state: stateSendToGPS, or stateDone when offlineSource has no more data.
+	 */ 
+	void stateReadOffline();
+
 	/**
 	 * @brief State machine handler used when done (internal)
 	 * 
@@ -954,6 +1082,8 @@ protected:
 	unsigned long packetDelay = 1;		//!< Delay in milliseconds between messages sent to the GPS during stateSendToGPS.
 	bool disableLocation = false;		//!< Set to true to disable getting location data. This causes slower time to first sync and larger downloads.
 	unsigned long waitLocationTimeoutMs = 10000; //!< Amount of time in milliseconds to wait for the location and elevation data to arrive.
+	std::function<int(uint8_t *buf, size_t len)> offlineSource = 0; //!< Reads pre-staged aiding data, set by withOfflineSource()
+	size_t offlineBufferSize = 1024;	//!< Size of the chunks read from offlineSource
 
 	String assistNowKey;				//!< Assist now API token/key. Required.
 	String assistNowServer = "online-live1.services.u-blox.com";	//!< Server to contact for u-blox aiding data
@@ -24,6 +24,8 @@
 
 // __________________________________________________________ PROJECT INCLUDES
 #include "i2c_adc_ads7828.h"
+#define I2C_TRACE_INTERPOSE
+#include "I2C_trace.h"
 
 
 // ___________________________________________________ PUBLIC MEMBER FUNCTIONS
@@ -502,6 +504,50 @@ uint8_t ADS7828::update(uint8_t ch)
 }
 
 
+/// Update a given set of channels on this device, averaging several
+/// conversions per channel.
+/// The command byte is sent once per channel; the device converts the
+/// selected channel again on every subsequent read, so each extra sample
+/// only costs one 2-byte read.
+/// \param mask bit positions containing a 1 represent channels to update
+///   (\ref channelMask is ignored)
+/// \param oversample conversions averaged into each sample (1..16)
+/// \return quantity of channels updated (0..8)
+/// \par Usage:
+/// \code
+/// ...
+/// ADS7828 adc(0);
+/// ...
+/// void loop()
+/// {
+///   ...
+///   // update device 0, channels 0..3, 4 conversions each
+///   uint8_t quantity = adc.scan(0x0F, 4);
+///   ...
+/// }
+/// ...
+/// \endcode
+uint8_t ADS7828::scan(uint8_t mask, uint8_t oversample)
+{
+  uint8_t ch, n, count = 0;
+  if (oversample < 1) oversample = 1;
+  if (oversample > 16) oversample = 16;   // 16 x 12 bits fits the 16-bit sum
+  for (ch = 0; ch < 8; ch++)
+  {
+    if (!bitRead(mask, ch)) continue;
+    if (0 != start(ch)) continue;
+    uint16_t sum = 0;
+    for (n = 0; n < oversample; n++)
+    {
+      sum += read();
+    }
+    channel(ch)->newSample(sum / oversample);
+    count++;
+  }
+  return count;
+}
+
+
 // ____________________________________________ STATIC PUBLIC MEMBER FUNCTIONS
 /// Enable I2C communication.
 /// \required Call from within \c setup()\c to enable I2C communication.
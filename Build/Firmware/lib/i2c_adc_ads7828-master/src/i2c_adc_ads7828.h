@@ -280,6 +280,7 @@ class ADS7828
     uint8_t start(uint8_t);
     uint8_t update(); // single device, all unmasked channel
     uint8_t update(uint8_t); // single device, single channel
+    uint8_t scan(uint8_t, uint8_t); // single device, channel set, oversampled
 
     // ........................................ static public member functions
     static void begin();
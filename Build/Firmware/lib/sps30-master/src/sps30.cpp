@@ -126,6 +126,7 @@
 #include "sps30.h"
 #include <stdarg.h>
 #include <stdio.h>
+#include "I2C_trace.h"
 
 #if !defined INCLUDE_I2C && !defined INCLUDE_UART
 #error you must enable either I2C or UART communication
@@ -250,6 +251,7 @@ bool SPS30::begin(TwoWire *wirePort)
 #if defined INCLUDE_I2C
     _Sensor_Comms = I2C_COMMS;
     _i2cPort = wirePort;            // Grab which port the user wants us to use
+    _i2cTrace = &TracedWire::of(*wirePort);
     _i2cPort->setClock(100000);     // 1.4.8 Apollo3 is default 400K (although stated differently in 2.0.1)
     return true;
 #else
@@ -590,7 +592,7 @@ bool SPS30::Instruct(uint8_t type)
             _started = false;
 #if defined INCLUDE_I2C
             if (_Sensor_Comms == I2C_COMMS) {
-                _i2cPort->begin();       // some I2C channels need a reset
+                _i2cTrace->begin();       // some I2C channels need a reset
             }
 #endif
             delay(2000);
@@ -1480,6 +1482,7 @@ void SPS30::I2C_init()
 {
     Wire.begin();               // changed 1.4.2.
     _i2cPort = &Wire;
+    _i2cTrace = &TracedWire::of(Wire);
     _i2cPort->setClock(100000); // 1.4.8 Apollo3 V2.0 is default 400K (although stated differently)
 }
 
@@ -1542,9 +1545,9 @@ uint8_t SPS30::I2C_SetPointer()
         DebugPrintf("\n");
     }
 
-    _i2cPort->beginTransmission(SPS30_ADDRESS);
-    _i2cPort->write(_Send_BUF, _Send_BUF_Length);
-    _i2cPort->endTransmission();
+    _i2cTrace->beginTransmission(SPS30_ADDRESS);
+    _i2cTrace->write(_Send_BUF, _Send_BUF_Length);
+    _i2cTrace->endTransmission();
 
     return(SPS30_ERR_OK);
 }
@@ -1603,11 +1606,11 @@ uint8_t SPS30::I2C_ReadToBuffer(uint8_t count, bool chk_zero)
     j = i = _Receive_BUF_Length = 0;
 
     // 2 data bytes  + crc
-    _i2cPort->requestFrom((uint8_t) SPS30_ADDRESS, uint8_t (count / 2 * 3));
+    _i2cTrace->requestFrom((uint8_t) SPS30_ADDRESS, uint8_t (count / 2 * 3));
 
-    while (_i2cPort->available()) { // wait till all arrive
+    while (_i2cTrace->available()) { // wait till all arrive
 
-        data[i++] = _i2cPort->read();
+        data[i++] = _i2cTrace->read();
 //DebugPrintf("data 0x%02X\n", data[i-1]);
         // 2 bytes RH, 1 CRC
         if( i == 3) {
@@ -1629,7 +1632,7 @@ uint8_t SPS30::I2C_ReadToBuffer(uint8_t count, bool chk_zero)
 
                     // flush any bytes pending (added 1.4.8 as the Apollo 2.0.1 was NOT clearing rxBuffer)
                     // Logged as an issue and expect this could be removed in the future
-                    while (_i2cPort->available()) _i2cPort->read();
+                    while (_i2cTrace->available()) _i2cTrace->read();
                     return(SPS30_ERR_OK);
                 }
             }
@@ -467,6 +467,8 @@ enum SPS_status {
 #define SPS30_ADDRESS 0x69                 // I2c address
 /***************************************************************/
 
+class TracedWire;       // I2C_trace.h in cscore
+
 class SPS30
 {
   public:
@@ -673,6 +675,7 @@ class SPS30
 #if defined INCLUDE_I2C
     /** I2C communication */
     TwoWire *_i2cPort;      // holds the I2C port
+    TracedWire *_i2cTrace;  // I2C trace of _i2cPort
     void I2C_init();
     void I2C_fill_buffer(uint16_t cmd, uint32_t interval = 0);
     uint8_t I2C_ReadToBuffer(uint8_t count, bool chk_zero);
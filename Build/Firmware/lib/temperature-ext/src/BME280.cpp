@@ -22,6 +22,7 @@ Distributed as-is; no warranty is given.
 
 #include <math.h>
 #include "BME280.h"
+#include "I2C_trace.h"
 
 //****************************************************************************//
 //
@@ -154,6 +155,7 @@ bool BME280::beginSPI(uint8_t csPin)
 bool BME280::beginI2C(TwoWire &wirePort)
 {
 	_hardPort = &wirePort;
+	_hardTrace = &TracedWire::of(wirePort);
 	_wireType = HARD_WIRE;
 
 	settings.commInterface = I2C_MODE;
@@ -656,15 +658,15 @@ void BME280::readRegisterRegion(uint8_t *outputPointer , uint8_t offset, uint8_t
 		switch(_wireType)
 		{
 			case(HARD_WIRE):
-				_hardPort->beginTransmission(settings.I2CAddress);
-				_hardPort->write(offset);
-				_hardPort->endTransmission();
+				_hardTrace->beginTransmission(settings.I2CAddress);
+				_hardTrace->write(offset);
+				_hardTrace->endTransmission();
 
 				// request bytes from slave device
-				_hardPort->requestFrom(settings.I2CAddress, length);
-				while ( (_hardPort->available()) && (i < length))  // slave may send less than requested
+				_hardTrace->requestFrom(settings.I2CAddress, length);
+				while ( (_hardTrace->available()) && (i < length))  // slave may send less than requested
 				{
-					c = _hardPort->read(); // receive a byte as character
+					c = _hardTrace->read(); // receive a byte as character
 					*outputPointer = c;
 					outputPointer++;
 					i++;
@@ -725,14 +727,14 @@ uint8_t BME280::readRegister(uint8_t offset)
 		switch(_wireType)
 		{
 			case(HARD_WIRE):
-				_hardPort->beginTransmission(settings.I2CAddress);
-				_hardPort->write(offset);
-				_hardPort->endTransmission();
+				_hardTrace->beginTransmission(settings.I2CAddress);
+				_hardTrace->write(offset);
+				_hardTrace->endTransmission();
 
-				_hardPort->requestFrom(settings.I2CAddress, numBytes);
-				while ( _hardPort->available() ) // slave may send less than requested
+				_hardTrace->requestFrom(settings.I2CAddress, numBytes);
+				while ( _hardTrace->available() ) // slave may send less than requested
 				{
-					result = _hardPort->read(); // receive a byte as a proper uint8_t
+					result = _hardTrace->read(); // receive a byte as a proper uint8_t
 				}
 				break;
 			
@@ -782,10 +784,10 @@ void BME280::writeRegister(uint8_t offset, uint8_t dataToWrite)
 		switch(_wireType)
 		{
 			case(HARD_WIRE):
-				_hardPort->beginTransmission(settings.I2CAddress);
-				_hardPort->write(offset);
-				_hardPort->write(dataToWrite);
-				_hardPort->endTransmission();
+				_hardTrace->beginTransmission(settings.I2CAddress);
+				_hardTrace->write(offset);
+				_hardTrace->write(dataToWrite);
+				_hardTrace->endTransmission();
 				break;
 			case(SOFT_WIRE):
 			#ifdef SoftwareWire_h
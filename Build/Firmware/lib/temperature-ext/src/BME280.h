@@ -181,6 +181,8 @@ struct BME280_SensorMeasurements
 	float humidity;
 };
 
+class TracedWire; //I2C_trace.h in cscore
+
 //This is the main operational class of the driver.
 
 class BME280
@@ -266,6 +268,7 @@ private:
 
     uint8_t _wireType = HARD_WIRE; //Default to Wire.h
     TwoWire *_hardPort = NO_WIRE; //The generic connection to user's chosen I2C hardware
+    TracedWire *_hardTrace = NO_WIRE; //I2C trace of _hardPort, set in beginI2C()
     
 	#ifdef SoftwareWire_h
 	SoftwareWire *_softPort = NO_WIRE; //Or, the generic connection to software wire port
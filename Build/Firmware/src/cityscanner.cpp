@@ -46,10 +46,20 @@ void Cityscanner::startup()
 
 void blink(void);
 
+// Appends a group of comma separated columns to a record
+static void addColumns(String &payload, const String &columns)
+{
+  if (payload.length())
+    payload += ',';
+  payload += columns;
+}
+
 int Cityscanner::init()
 {
   delay(3s);
   Log.info("Init block");
+  CitySettings::instance().load();
+  mode = CitySettings::instance().get().mode;
   checkbattery();
   initCLI();
   Log.info("Starting Core Library");
@@ -72,48 +82,39 @@ int Cityscanner::init()
       sendWarning("I_AM_OKAY");
   }
 
+  applySettings();
   sample_timer.start();
   vitals_timer.start();
   routine_timer.start();
 
-  switch (MODE)
+  switch (mode)
   {
   case TEST:
     break;
   case LOGGING:
-    //Serial.println("Turning ON 3V3");
-    //core.enable3V3(true);
-    delay(DTIME);
-    delay(1s);
-    Serial.println("Turning ON GPS");
-    locationService.start();
-    delay(DTIME);
-    Serial.println("Turning ON Vitals");
-    vitals.init(); // TBC
-    delay(DTIME);
-    Serial.println("Turning ON 5V line");
-    core.enable5V(true);
-    delay(DTIME);
-    Serial.println("Turning ON 5V line");
-
-    Serial.println("Turning ON Gas sensor");
-    sense.startGAS(); // TBC
-    delay(DTIME);
-    delay(1s);
-
-    Serial.println("Turning ON Temperature sensor");
-    sense.startTEMP(); // TBC
-    delay(DTIME);
-
-    delay(4s);
-    
-    if (OPC_ENABLED)
-    {
-      Serial.println("Turning ON OPC");
-      sense.startOPC();
-      delay(DTIME);
-    }
+  {
+    // Each sensor is started as soon as its rail is up and it answers its probe
+    CityPower &power = CityPower::instance();
+    Serial.println("Turning ON 3V3, GPS and 5V lines");
+    power.enableRail(CityPower::RAIL_3V3);
+    power.enableRail(CityPower::RAIL_GPS);
+    power.enableRail(CityPower::RAIL_5V);
+    power.addStep("GPS", CityPower::RAIL_GPS, [this]() { return locationService.start() == 1; });
+    if (BATT_ENABLED)
+      power.addStep("Battery", CityPower::RAIL_NONE, [this]() { return vitals.startBattery(); });
+    power.addStep("Solar", CityPower::RAIL_3V3, [this]() { return vitals.startSolar(); });
+    power.addStep("Internal temperature", CityPower::RAIL_3V3, [this]() { return vitals.startTempInt(); });
+    if (SENSORS.gas)
+      power.addStep("Gas sensor", CityPower::RAIL_3V3, [this]() { return sense.startGAS(); });
+    if (SENSORS.temp)
+      power.addStep("Temperature sensor", CityPower::RAIL_3V3, [this]() { return sense.startTEMP(); });
+    if (SENSORS.opc)
+      power.addStep("OPC", CityPower::RAIL_5V, [this]() { return sense.startOPC(); });
+    power.run();
+    if (SENSORS.gas && !sense.gasSampling())
+      sendWarning("GAS_NOT_SAMPLING");
     break;
+  }
   default:
     /*Serial.println("Turning ON NOISE sensor");
     sense.startNOISE();
@@ -152,37 +153,65 @@ int Cityscanner::init()
 
 void Cityscanner::loop()
 {
+  PROFILE_SCOPE(PROFILE_LOOP);
+
+  // One position per cycle, the fix_type column and the lat/lon of the records come from it
+  if (flag_sampling || flag_vitals)
+    locationService.updatePosition();
 
   if (flag_sampling)
   {
     flag_sampling = false;
 
-    if (HARVARD_PILOT)
+    // Sensors are read before formatting so the two can be profiled separately,
+    // the sensors that are not in SENSORS are compiled out of both
+    String opc, temp, ir, gas, noise, fix, motion, vibration;
     {
-      data_payload = String::format("%s,%s,%s", sense.getOPCdata(EXTENDED).c_str(), // PM1,PM25,PM10,[bins],flow_rate,countglitch,laser_status,tempOPC,humOPC,valid
-                                    sense.getTEMPdata().c_str(),                    // temp,humidity
-                                    sense.getGASdata().c_str());                    // w1,r1
+      PROFILE_SCOPE(PROFILE_SENSORS);
+      if (SENSORS.opc)
+        opc = sense.getOPCdata(HARVARD_PILOT ? EXTENDED : CitySettings::instance().get().opc_data_version);
+      if (SENSORS.temp)
+        temp = sense.getTEMPdata();
+      if (SENSORS.ir)
+        ir = sense.getIRdata();
+      if (SENSORS.gas)
+        gas = sense.getGASdata();
+      if (SENSORS.noise)
+        noise = sense.getNOISEdata();
+      fix = locationService.getFixType();
+      motion = motionService.getMOTIONdata();
+      vibration = motionService.getVIBRATIONdata();
     }
-    else
-    {
 
-      data_payload = String::format("%s,%s,%s,%s,%s", sense.getOPCdata(OPC_DATA_VERSION).c_str(), // PM1,PM25,PM10,[bins],flow_rate,countglitch,laser_status,tempopc,humopc,valid
-                                    sense.getTEMPdata().c_str(),                                     // temp,humidity
-                                    sense.getIRdata().c_str(),                                       // IR_temperature
-                                    sense.getGASdata().c_str(),                                      // w1,r1,w2,r2
-                                    sense.getNOISEdata().c_str());                                    // noise
-                                    
-
-    
+    {
+      PROFILE_SCOPE(PROFILE_FORMAT);
+      // Keep in sync with the Data layout in cityscanner_schema.cpp
+      data_payload = "";
+      if (SENSORS.opc)
+        addColumns(data_payload, opc);       // PM1,PM25,PM4,PM10,[num],size,coarse,ratio,growth
+      if (SENSORS.temp)
+        addColumns(data_payload, temp);      // temp,humidity
+      if (SENSORS.ir)
+        addColumns(data_payload, ir);        // ambient_IR,object_IR
+      if (SENSORS.gas)
+        addColumns(data_payload, gas);       // w1,r1,w2,r2,[min,max,sd],[ppb]
+      if (SENSORS.noise)
+        addColumns(data_payload, noise);     // noise
+      addColumns(data_payload, fix);         // fix_type
+      addColumns(data_payload, motion);      // vib_rms,jerk_max,starts,stops,moving
+      addColumns(data_payload, vibration);   // vib_band1..n
     }
 
-    switch (MODE)
+    switch (mode)
     {
     case IDLE:
       Log.info("Idle Mode");
       break;
     case REALTIME:
-      store.logData(BROADCAST_IMMEDIATE, Data, data_payload);
+      {
+        PROFILE_SCOPE(PROFILE_STORE);
+        store.logData(BROADCAST_IMMEDIATE, Data, data_payload);
+      }
       Log.info("Real Time");
       break;
     case LOGGING:
@@ -193,8 +222,10 @@ void Cityscanner::loop()
       // printDebug();
       //Serial.print("Temp data : ");
       //Serial.println(sense.getTEMPdata().c_str());
-      Serial.println(vitals.getTempIntData().c_str());
-      store.logData(BROADCAST_NONE, Data, data_payload);
+      {
+        PROFILE_SCOPE(PROFILE_STORE);
+        store.logData(BROADCAST_NONE, Data, data_payload);
+      }
       Log.info("Data Logging");
       // Serial.print("IR: "); Serial.println(sense.getIRdata());
       // Serial.print("BATT: "); Serial.println(vitals.getBatteryData());
@@ -215,14 +246,17 @@ void Cityscanner::loop()
   if (flag_vitals)
   {
     flag_vitals = false;
+    PROFILE_SCOPE(PROFILE_VITALS);
 
-    vitals_payload = String::format("%s,%s,%s,%s,%s", vitals.getBatteryData().c_str(), // SOC,temp,voltage,voltage_Partice,current_mA,is_charging
+    vitals_payload = String::format("%s,%s,%s,%s,%s,%s,%s", vitals.getBatteryData().c_str(), // SOC,temp,voltage,voltage_Partice,current_mA,is_charging
                                     vitals.getChargingStatus().c_str(),                // isCharging,isCharged
                                     vitals.getTempIntData().c_str(),                   // temp_int,hum_int
                                     vitals.getSolarData().c_str(),                     // solar_volt,solar_current
-                                    vitals.getSignalStrenght().c_str());               // Cellular signal strenght
+                                    vitals.getSignalStrenght().c_str(),                // Cellular signal strenght
+                                    vitals.getI2Cdata().c_str(),                       // addr:transactions/bytes/nacks/timeouts/us;...
+                                    vitals.getHeapData().c_str());                     // heap_used,heap_peak,heap_free,largest_block,free_chunks
 
-    switch (MODE)
+    switch (mode)
     {
     case IDLE:
       Log.info("Idle Mode");
@@ -251,28 +285,95 @@ void Cityscanner::loop()
     Log.info("Routine operations");
     flag_routine = false;
     checkbattery();
+    if (STATS_RECORD)
+      store.logData(BROADCAST_NONE, Stats, getStats(true));
   }
 
-  motionService.loop();
+  {
+    PROFILE_SCOPE(PROFILE_LOCATION);
+    locationService.loop();
+  }
+  {
+    PROFILE_SCOPE(PROFILE_MOTION);
+    motionService.loop();
+  }
+  store.loop();
   // Serial.print("Tap: "); Serial.println(digitalRead(WKP));
   
 }
 
 void Cityscanner::checkbattery()
 {
-  int batt_volt_adc = analogRead(BATTERY_VOLTAGE_PIN);
-  float battery_v = (batt_volt_adc / 4095.0) * 3.3 * 2;
+  CitySleep &sleep = CitySleep::instance();
+  uint8_t previous_tier = sleep.energy_tier;
+  float battery_v = vitals.getBatteryVoltage();
   Log.info("Battery voltage:" + String(battery_v));
-  if (battery_v < LOW_BATTERY_THRESHOLD)
+  uint8_t tier = sleep.plan();
+  if (tier == CitySleep::ENERGY_CRITICAL)
   {
     String message = "LOW_BATTERY_" + String(battery_v) + "_v";
     Log.info(message);
     sendWarning(message);
     delay(2s);
-    CitySleep::instance().hibernate(6, HOURS);
+    sleep.hibernate(sleep.getHibernateHours(), HOURS);
+  }
+  else if (tier != previous_tier)
+    applyEnergyTier(tier);
+  else if (tier == CitySleep::ENERGY_SAVE && sense.OPC_started)
+    applyEnergyTier(tier); // OPC restarted by init or a wake-up, pause it again
+}
+
+void Cityscanner::applyEnergyTier(uint8_t tier)
+{
+  TRACE(TRACE_ENERGY_TIER, tier, 0);
+  sample_timer.changePeriod(CitySettings::instance().get().sample_rate * 1000 * CitySleep::instance().getSampleFactor());
+  if (tier == CitySleep::ENERGY_SAVE)
+  {
+    sendWarning("ENERGY_SAVE");
+    if (sense.OPC_started)
+    {
+      sense.stopOPC();
+      core.enableOPC(FALSE);
+      CityPower::instance().disableRail(CityPower::RAIL_5V);
+      opc_paused = true;
+    }
+  }
+  else if (tier == CitySleep::ENERGY_NORMAL)
+  {
+    sendWarning("ENERGY_NORMAL");
+    if (opc_paused)
+    {
+      CityPower &power = CityPower::instance();
+      power.enableRail(CityPower::RAIL_5V);
+      power.addStep("OPC", CityPower::RAIL_5V, [this]() { return sense.startOPC(); });
+      power.run();
+      opc_paused = false;
+    }
   }
 }
 
+// Timers and file size follow the settings, the mode only changes on the next boot
+void Cityscanner::applySettings()
+{
+  const Settings &settings = CitySettings::instance().get();
+  sample_timer.changePeriod(settings.sample_rate * 1000 * CitySleep::instance().getSampleFactor());
+  vitals_timer.changePeriod(settings.vitals_rate * 1000);
+  store.records = settings.records_per_file;
+}
+
+// loop_p50,loop_p99,loop_max (us),sd_write_avg_us,sd_write_max_us,queued_files,queued_bytes,upload_Bps,i2c_errors,uptime (s)
+// Only the routine Stats record resets the counters, queries leave them running
+String Cityscanner::getStats(bool reset_counters)
+{
+  CityProfile &profile = CityProfile::instance();
+  String loop_time = "na,na,na";
+  if (PROFILER)
+    loop_time = String::format("%lu,%lu,%lu", profile.percentile(CityProfile::PROFILE_LOOP, 50),
+                               profile.percentile(CityProfile::PROFILE_LOOP, 99), profile.maximum(CityProfile::PROFILE_LOOP));
+  return String::format("%s,%s,%lu,%lu", loop_time.c_str(), store.getStats(reset_counters).c_str(),
+                        I2CTrace::instance().errors(), (unsigned long)System.uptime());
+}
+
 void Cityscanner::sendWarning(String warning)
 {
   // String tempp = deviceID + "," + Time.now() + "," + warning;
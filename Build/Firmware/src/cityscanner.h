@@ -4,6 +4,10 @@
 #include "cityscanner_sense.h"
 #include "cityscanner_vitals.h"
 #include "cityscanner_sleep.h"
+#include "cityscanner_profile.h"
+#include "cityscanner_trace.h"
+#include "I2C_trace.h"
+#include "cityscanner_settings.h"
 #include "CS_core.h"
 #include "location_service.h"
 #include "motion_service.h"
@@ -46,6 +50,9 @@ public:
     void startShippingMode();
     void checkbattery();
     void sendWarning(String);
+    String getStats(bool reset_counters);
+    void applySettings(void);
+    uint8_t mode = MODE;    // from the settings, read once at boot
     int counter = 0;
     bool debug_mode = DEBUG;
     int16_t ret;
@@ -56,4 +63,6 @@ private:
     Cityscanner();
     static Cityscanner *_instance;
     void printDebug();
+    void applyEnergyTier(uint8_t tier);
+    bool opc_paused = false;
 };
\ No newline at end of file
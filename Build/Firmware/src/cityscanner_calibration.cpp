@@ -0,0 +1,101 @@
+#include "cityscanner_calibration.h"
+#include "SD.h"
+
+CityCalibration *CityCalibration::_instance = nullptr;
+
+CityCalibration::CityCalibration() {
+    for(int i = 0; i < GAS_SENSORS; i++)
+        sensors[i].valid = false;
+}
+
+// Coefficients are parsed once as floats and kept in fixed-point, ppb() only uses integer math
+int CityCalibration::load(const char *filename)
+{
+    int count = 0;
+    for(int i = 0; i < GAS_SENSORS; i++)
+        sensors[i].valid = false;
+
+    if(!SD.exists(filename))
+    {
+        Log.info("Gas calibration: %s not found", filename);
+        return 0;
+    }
+    File file = SD.open(filename, O_READ);
+    if(!file)
+        return 0;
+
+    while(file.available())
+    {
+        String line = file.readStringUntil('\n');
+        line.trim();
+        if(line.length() == 0 || line.charAt(0) == '#')
+            continue;
+
+        const char *p = line.c_str();
+        char *end;
+        float values[4 + GAS_CAL_TEMP_POINTS];
+        int fields = 0;
+        while(fields < 4 + GAS_CAL_TEMP_POINTS)
+        {
+            values[fields] = strtof(p, &end);
+            if(end == p)
+                break;
+            p = end;
+            fields++;
+        }
+        int sensor = (int)values[0];
+        if(fields != 4 + GAS_CAL_TEMP_POINTS || sensor < 1 || sensor > GAS_SENSORS || values[3] <= 0)
+        {
+            Log.info("Gas calibration: skipping line \"%s\"", line.c_str());
+            continue;
+        }
+
+        SensorCal &cal = sensors[sensor - 1];
+        cal.we_zero = values[1] * 1000;
+        cal.ae_zero = values[2] * 1000;
+        cal.sensitivity = values[3] * 1000000;
+        for(int i = 0; i < GAS_CAL_TEMP_POINTS; i++)
+            cal.n_t[i] = values[4 + i] * 1024;
+        if(!cal.valid)
+            count++;
+        cal.valid = true;
+    }
+    file.close();
+    Log.info("Gas calibration: %d sensors loaded from %s", count, filename);
+    return count;
+}
+
+bool CityCalibration::loaded(uint8_t sensor)
+{
+    return sensor >= 1 && sensor <= GAS_SENSORS && sensors[sensor - 1].valid;
+}
+
+// counts * Vref / 4096 with Vref in mV, *1000/4096 reduced to *125/512 to stay in 32 bits
+int32_t CityCalibration::countsToMicrovolts(uint16_t counts)
+{
+    return ((int32_t)counts * GAS_VREF_MV * 125) >> 9;
+}
+
+// nT linearly interpolated from the table, clamped at both ends, Q10
+int32_t CityCalibration::temperatureFactor(const SensorCal &cal, int16_t temperature)
+{
+    int32_t t = temperature - GAS_CAL_TEMP_MIN * 100;
+    if(t <= 0)
+        return cal.n_t[0];
+    int32_t index = t / (GAS_CAL_TEMP_STEP * 100);
+    if(index >= GAS_CAL_TEMP_POINTS - 1)
+        return cal.n_t[GAS_CAL_TEMP_POINTS - 1];
+    int32_t frac = t % (GAS_CAL_TEMP_STEP * 100);
+    return cal.n_t[index] + (cal.n_t[index + 1] - cal.n_t[index]) * frac / (GAS_CAL_TEMP_STEP * 100);
+}
+
+int32_t CityCalibration::ppb(uint8_t sensor, uint16_t we, uint16_t ae, int16_t temperature)
+{
+    if(!loaded(sensor))
+        return 0;
+    const SensorCal &cal = sensors[sensor - 1];
+    int32_t we_uv = countsToMicrovolts(we) - cal.we_zero;
+    int32_t ae_uv = countsToMicrovolts(ae) - cal.ae_zero;
+    int32_t wec = we_uv - (int32_t)(((int64_t)temperatureFactor(cal, temperature) * ae_uv) >> 10);
+    return (int32_t)((int64_t)wec * 10000 / cal.sensitivity);
+}
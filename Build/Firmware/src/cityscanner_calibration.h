@@ -0,0 +1,58 @@
+#pragma once
+#include "Particle.h"
+#include "cityscanner_CONFIG.h"
+
+#define GAS_SENSORS 2           // SN1 on adc0/adc1 (gas_op1), SN2 on adc2/adc3 (gas_op2)
+#define GAS_CAL_TEMP_POINTS 9   // -30C to 50C every 10C
+#define GAS_CAL_TEMP_MIN -30
+#define GAS_CAL_TEMP_STEP 10
+
+class CityCalibration {
+    public:
+        static CityCalibration &instance() {
+            if(!_instance) {
+                _instance = new CityCalibration();
+            }
+            return *_instance;
+        }
+
+        /**
+         * @brief Load the sensor coefficients from a text file on the SD card
+         *
+         * One line per sensor, '#' starts a comment:
+         * sensor(1|2) WE_zero(mV) AE_zero(mV) sensitivity(mV/ppb) nT(-30C) nT(-20C) ... nT(50C)
+         *
+         * @retval number of sensors loaded
+         */
+        int load(const char *filename);
+        bool loaded(uint8_t sensor);
+
+        /**
+         * @brief Working/auxiliary electrode counts to concentration
+         *
+         * WEc = (WE - WE0) - nT * (AE - AE0), ppb = WEc / sensitivity
+         *
+         * @param sensor 1 or 2
+         * @param we working electrode, raw ADS7828 counts
+         * @param ae auxiliary electrode, raw ADS7828 counts
+         * @param temperature ambient temperature in 1/100 C
+         * @retval concentration in 1/10 ppb
+         */
+        int32_t ppb(uint8_t sensor, uint16_t we, uint16_t ae, int16_t temperature);
+
+    private:
+        CityCalibration();
+        static CityCalibration* _instance;
+
+        struct SensorCal
+        {
+            bool valid;
+            int32_t we_zero;                        // uV
+            int32_t ae_zero;                        // uV
+            int32_t sensitivity;                    // nV/ppb
+            int16_t n_t[GAS_CAL_TEMP_POINTS];       // Q10
+        };
+        SensorCal sensors[GAS_SENSORS];
+        int32_t countsToMicrovolts(uint16_t counts);
+        int32_t temperatureFactor(const SensorCal &cal, int16_t temperature);
+};
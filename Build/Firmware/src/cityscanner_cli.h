@@ -6,24 +6,60 @@
 #include "cityscanner_vitals.h"
 #include "cityscanner_store.h"
 #include "cityscanner_sleep.h"
+#include "cityscanner_power.h"
 #include "cityscanner.h"
+#include "cityscanner_profile.h"
+#include "cityscanner_trace.h"
+
+#define CMD_MAX_LENGTH 512   //bytes of a command batch and of its results
+#define CMD_PUBLISH_LENGTH 300 //bytes of results in a CMD event, hex encoding doubles them
+#define CMD_FRAME_START 0x7E //first byte of a binary frame on Serial, text commands never start with it
 
 int commandLine(String command);
+int commandBatch(String hex);
+void serialFrame(void);
 
 int initCLI()
 {
   Log.info("CLI started");
   Particle.function("CLI", commandLine);
+  Particle.function("CMD", commandBatch);
   return 1;
 }
 
 void serialEvent()
 {
+  if (Serial.peek() == CMD_FRAME_START)
+  {
+    serialFrame();
+    return;
+  }
   String s = "na";
   s = Serial.readStringUntil(char(13));
   commandLine(s);
 }
 
+// Changes a setting (or all of them with "reset") and applies it, shared by the text and binary commands
+bool configure(String name, String value)
+{
+  CitySettings &settings = CitySettings::instance();
+  uint8_t opc_data = settings.get().opc_data_version;
+  if (!name.compareTo("reset"))
+  {
+    settings.reset();
+    settings.save();
+  }
+  else if (!settings.set(name, value))
+  {
+    Log.info("config: invalid " + name + "=" + value);
+    return false;
+  }
+  Cityscanner::instance().applySettings();
+  if (settings.get().opc_data_version != opc_data)
+    CityStore::instance().switch_logfile(); // new file, its header has the new Data layout
+  return true;
+}
+
 int commandLine(String command)
 {
   int index = command.indexOf(',');
@@ -79,18 +115,20 @@ int commandLine(String command)
   else if (!first_parameter.compareTo("sd"))
   {
     if (!second_parameter.compareTo("dump")){
-      if(!third_parameter.compareTo("all")){
-        Log.info("Dumping All Data Files");
-        CityStore::instance().dumpData(ALL_FILES);
-        if (Particle.connected())
-        Particle.publish("DUMP", "ended_dumping_all_data");
-      }
-      else{
-        Log.info("Dumping Some Data Files");
-        CityStore::instance().dumpData(third_parameter.toInt());
-        if (Particle.connected())
-        Particle.publish("DUMP", "ended_dumping_" + String(third_parameter.toInt()) + "_files");
+      // optional slot hint: <slot>/<slots>, or <slots> to derive the slot from the device ID
+      uint16_t slot = UINT16_MAX, slots = 0;
+      int slash = fourth_parameter.indexOf('/');
+      if (slash > 0)
+      {
+        slot = fourth_parameter.substring(0, slash).toInt();
+        slots = fourth_parameter.substring(slash + 1).toInt();
       }
+      else if (fourth_parameter.compareTo("na"))
+        slots = fourth_parameter.toInt();
+      int files = third_parameter.compareTo("all") ? third_parameter.toInt() : ALL_FILES;
+      uint32_t delay_s = CityStore::instance().scheduleDump(files, slot, slots);
+      if (Particle.connected())
+        Particle.publish("DUMP", "scheduled_in_" + String(delay_s) + "_s");
   }
   else if (!second_parameter.compareTo("files")){
     String files_in_queue = String::format("%u", CityStore::instance().countFilesInQueue());
@@ -164,6 +202,7 @@ int commandLine(String command)
   else if (!first_parameter.compareTo("location"))
   {
     String status = "na";
+    LocationService::instance().updatePosition();
     status = LocationService::instance().getGPSdata();
     Log.info(status);
     if (Particle.connected())
@@ -192,33 +231,69 @@ int commandLine(String command)
     if (Particle.connected())
       Particle.publish("OPC", opcdata);
   }
+  else if (!first_parameter.compareTo("profile"))
+  {
+    if (!second_parameter.compareTo("reset"))
+      CityProfile::instance().reset();
+    else
+    {
+      String report = CityProfile::instance().report();
+      Log.info(report);
+      Serial.println(report);
+      if (Particle.connected())
+        Particle.publish("PROFILE", report);
+    }
+  }
+  else if (!first_parameter.compareTo("config"))
+  {
+    if (second_parameter.compareTo("na") && !configure(second_parameter, third_parameter))
+      return -1;
+    String report = CitySettings::instance().report();
+    Log.info(report);
+    if (Particle.connected())
+      Particle.publish("CONFIG", report);
+  }
+  else if (!first_parameter.compareTo("trace"))
+  {
+    if (!second_parameter.compareTo("dump"))
+      CityTrace::instance().dump();
+    else if (!second_parameter.compareTo("clear"))
+      CityTrace::instance().clear();
+    else if (!second_parameter.compareTo("last"))
+    {
+      String events = CityTrace::instance().last(600);
+      Log.info(events);
+      if (Particle.connected())
+        Particle.publish("TRACE", events);
+    }
+  }
   //END COMMANDS
   else if (!first_parameter.compareTo("enable3v"))
   {
     if (!second_parameter.compareTo("on"))
     {
-      CS_core::instance().enable3V3(1);
+      CityPower::instance().enableRail(CityPower::RAIL_3V3);
     }
     else if (!second_parameter.compareTo("off"))
     {
-      CS_core::instance().enable3V3(0);
+      CityPower::instance().disableRail(CityPower::RAIL_3V3);
     }
   }
   else if (!first_parameter.compareTo("enable5v"))
   {
     if (!second_parameter.compareTo("on"))
     {
-      CS_core::instance().enable5V(1);
+      CityPower::instance().enableRail(CityPower::RAIL_5V);
     }
     else if (!second_parameter.compareTo("off"))
     {
-      CS_core::instance().enable5V(0);
+      CityPower::instance().disableRail(CityPower::RAIL_5V);
     } 
   }
   else if (!first_parameter.compareTo("3v3on"))
   {
     Serial.println("Turning ON 3V3");
-    CS_core::instance().enable3V3(true);
+    CityPower::instance().enableRail(CityPower::RAIL_3V3);
     delay(DTIME);
     Serial.println("Turning ON GPS");
     LocationService::instance().start();
@@ -226,15 +301,24 @@ int commandLine(String command)
     Serial.println("Turning ON Vitals");
     CityVitals::instance().init();
     delay(DTIME);
-    Serial.println("Turning ON NOISE sensor");
-    CitySense::instance().startNOISE();
-    delay(DTIME);
-    Serial.println("Turning ON Temperature sensor");
-    CitySense::instance().startTEMP();
-    delay(DTIME);
-    Serial.println("Turning ON Gas ADC");
-    CitySense::instance().startGAS();
-    delay(DTIME);
+    if (SENSORS.noise)
+    {
+      Serial.println("Turning ON NOISE sensor");
+      CitySense::instance().startNOISE();
+      delay(DTIME);
+    }
+    if (SENSORS.temp)
+    {
+      Serial.println("Turning ON Temperature sensor");
+      CitySense::instance().startTEMP();
+      delay(DTIME);
+    }
+    if (SENSORS.gas)
+    {
+      Serial.println("Turning ON Gas ADC");
+      CitySense::instance().startGAS();
+      delay(DTIME);
+    }
   }
   else if (!first_parameter.compareTo("3v3off"))
   {
@@ -252,7 +336,7 @@ int commandLine(String command)
     CitySense::instance().stopTEMP();
     delay(DTIME);
     Serial.println("Turning OFF 3V3");
-    CS_core::instance().enable3V3(false);
+    CityPower::instance().disableRail(CityPower::RAIL_3V3);
     delay(DTIME);
     Serial.println("Turning OFF Gas ADC");
     CitySense::instance().stopGAS();
@@ -261,7 +345,7 @@ int commandLine(String command)
   else if (!first_parameter.compareTo("5von"))
   {
     Serial.println("Turning ON 5V");
-    CS_core::instance().enable5V(true);
+    CityPower::instance().enableRail(CityPower::RAIL_5V);
     delay(DTIME);
   }
   else if (!first_parameter.compareTo("5voff"))
@@ -270,10 +354,10 @@ int commandLine(String command)
     CitySense::instance().stopOPC();
     delay(DTIME);
     Serial.println("Turning OFF 5V");
-    CS_core::instance().enable5V(false);
+    CityPower::instance().disableRail(CityPower::RAIL_5V);
   }
   else if (!first_parameter.compareTo("opcon")){
-      CS_core::instance().enable5V(true);
+      CityPower::instance().enableRail(CityPower::RAIL_5V);
       delay(1s);
       Serial.println("Turning ON OPC");
       CitySense::instance().startOPC();
@@ -284,3 +368,258 @@ int commandLine(String command)
   }
   return 1;
 }
+
+// Binary command channel: a batch of TLV commands [type][length][value] in one call,
+// answered with one TLV result per command [type][status][length][value].
+// Over the cloud the batch is hex encoded in the "CMD" function and the results are
+// published as hex in a "CMD" event, over Serial both travel in frames
+// [CMD_FRAME_START][length lo][length hi][payload][crc8]. See tools/command_batch.py
+
+// Command types, keep in sync with tools/command_batch.py
+enum CommandTypes
+{
+  CMD_PING = 1,     // -> uptime,free_memory
+  CMD_CONFIG,       // -> settings report
+  CMD_CONFIG_SET,   // "name=value" -> settings report
+  CMD_CONFIG_RESET, // -> settings report
+  CMD_SD_FILES,     // -> files in the queue
+  CMD_SD_DUMP,      // [uint16 files, 0 or none for all][uint16 slot][uint16 slots] -> seconds until the dump
+  CMD_STATS,        // -> Stats record
+  CMD_PROFILE,      // -> profile report
+  CMD_TRACE_LAST,   // [uint16 max length] -> newest trace events
+  CMD_TEXT          // text command as in commandLine() -> its return code
+};
+
+enum CommandStatus
+{
+  CMD_OK = 0,
+  CMD_INVALID = -1,   // bad value or the command failed
+  CMD_UNKNOWN = -2,   // no such command type
+  CMD_TRUNCATED = -3  // result did not fit in CMD_MAX_LENGTH
+};
+
+typedef int (*CommandHandler)(const uint8_t *value, uint8_t length, String &result);
+
+static String commandText(const uint8_t *value, uint8_t length)
+{
+  char text[256];
+  memcpy(text, value, length);
+  text[length] = '\0';
+  return String(text);
+}
+
+static uint16_t commandU16(const uint8_t *value, uint8_t length, uint16_t missing)
+{
+  return length >= 2 ? value[0] | (value[1] << 8) : missing;
+}
+
+static int cmdPing(const uint8_t *value, uint8_t length, String &result)
+{
+  result = String::format("%lu,%lu", (unsigned long)System.uptime(), System.freeMemory());
+  return CMD_OK;
+}
+
+static int cmdConfig(const uint8_t *value, uint8_t length, String &result)
+{
+  result = CitySettings::instance().report();
+  return CMD_OK;
+}
+
+static int cmdConfigSet(const uint8_t *value, uint8_t length, String &result)
+{
+  String text = commandText(value, length);
+  int equal = text.indexOf('=');
+  if (equal <= 0 || !configure(text.substring(0, equal), text.substring(equal + 1)))
+    return CMD_INVALID;
+  result = CitySettings::instance().report();
+  return CMD_OK;
+}
+
+static int cmdConfigReset(const uint8_t *value, uint8_t length, String &result)
+{
+  configure("reset", "");
+  result = CitySettings::instance().report();
+  return CMD_OK;
+}
+
+static int cmdSdFiles(const uint8_t *value, uint8_t length, String &result)
+{
+  result = String(CityStore::instance().countFilesInQueue());
+  return CMD_OK;
+}
+
+static int cmdSdDump(const uint8_t *value, uint8_t length, String &result)
+{
+  uint16_t files = commandU16(value, length, 0);
+  uint16_t slot = length >= 4 ? commandU16(value + 2, length - 2, UINT16_MAX) : UINT16_MAX;
+  uint16_t slots = length >= 6 ? commandU16(value + 4, length - 4, 0) : 0;
+  result = String(CityStore::instance().scheduleDump(files ? files : ALL_FILES, slot, slots));
+  return CMD_OK;
+}
+
+static int cmdStats(const uint8_t *value, uint8_t length, String &result)
+{
+  result = Cityscanner::instance().getStats(false);
+  return CMD_OK;
+}
+
+static int cmdProfile(const uint8_t *value, uint8_t length, String &result)
+{
+  result = CityProfile::instance().report();
+  return CMD_OK;
+}
+
+static int cmdTraceLast(const uint8_t *value, uint8_t length, String &result)
+{
+  result = CityTrace::instance().last(commandU16(value, length, 200));
+  return CMD_OK;
+}
+
+static int cmdText(const uint8_t *value, uint8_t length, String &result)
+{
+  int ret = commandLine(commandText(value, length));
+  result = String(ret);
+  return ret < 0 ? CMD_INVALID : CMD_OK;
+}
+
+// Indexed by CommandTypes
+static const CommandHandler command_table[] = {
+  NULL,
+  cmdPing,
+  cmdConfig,
+  cmdConfigSet,
+  cmdConfigReset,
+  cmdSdFiles,
+  cmdSdDump,
+  cmdStats,
+  cmdProfile,
+  cmdTraceLast,
+  cmdText,
+};
+
+/**
+ * @brief Run every command of a batch and write their results
+ *
+ * @retval length of the results, -1 if the batch is malformed (nothing is run)
+ */
+int runBatch(const uint8_t *batch, size_t length, uint8_t *results, size_t size)
+{
+  for (size_t i = 0; i < length; i += 2 + batch[i + 1])
+    if (i + 2 > length || i + 2 + batch[i + 1] > length)
+      return -1;
+
+  size_t written = 0;
+  for (size_t i = 0; i < length; i += 2 + batch[i + 1])
+  {
+    uint8_t type = batch[i];
+    String result;
+    int status = CMD_UNKNOWN;
+    if (type < sizeof(command_table) / sizeof(command_table[0]) && command_table[type])
+      status = command_table[type](batch + i + 2, batch[i + 1], result);
+    Log.info("CMD %u: %d %s", type, status, result.c_str());
+
+    size_t result_length = min(result.length(), (unsigned int)255);
+    if (written + 3 + result_length > size)
+    {
+      status = CMD_TRUNCATED;
+      result_length = 0;
+      if (written + 3 > size)
+        break;
+    }
+    results[written++] = type;
+    results[written++] = (uint8_t)status;
+    results[written++] = result_length;
+    memcpy(results + written, result.c_str(), result_length);
+    written += result_length;
+  }
+  return written;
+}
+
+static int hexDigit(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// Particle.function "CMD": hex encoded batch, the results are published in a "CMD" event
+int commandBatch(String hex)
+{
+  uint8_t batch[CMD_MAX_LENGTH];
+  size_t length = hex.length() / 2;
+  if (hex.length() % 2 || length > sizeof(batch))
+    return -1;
+  for (size_t i = 0; i < length; i++)
+  {
+    int high = hexDigit(hex.charAt(2 * i));
+    int low = hexDigit(hex.charAt(2 * i + 1));
+    if (high < 0 || low < 0)
+      return -1;
+    batch[i] = (high << 4) | low;
+  }
+
+  uint8_t results[CMD_PUBLISH_LENGTH];
+  int written = runBatch(batch, length, results, sizeof(results));
+  if (written < 0)
+    return -1;
+  static const char digits[] = "0123456789abcdef";
+  String response;
+  response.reserve(2 * written);
+  for (int i = 0; i < written; i++)
+  {
+    response += digits[results[i] >> 4];
+    response += digits[results[i] & 0x0F];
+  }
+  Log.info("CMD: " + response);
+  if (Particle.connected())
+    Particle.publish("CMD", response);
+  return written;
+}
+
+// CRC-8, polynomial 0x07
+static uint8_t frameCrc(const uint8_t *data, size_t length)
+{
+  uint8_t crc = 0;
+  while (length--)
+  {
+    crc ^= *data++;
+    for (int i = 0; i < 8; i++)
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+static void writeFrame(const uint8_t *payload, size_t length)
+{
+  uint8_t header[3] = {CMD_FRAME_START, (uint8_t)(length & 0xFF), (uint8_t)(length >> 8)};
+  uint8_t crc = frameCrc(payload, length);
+  Serial.write(header, sizeof(header));
+  Serial.write(payload, length);
+  Serial.write(crc);
+}
+
+// Binary frame on Serial, answered with a frame holding the results (empty if the frame is not valid)
+void serialFrame()
+{
+  uint8_t header[3];
+  uint8_t batch[CMD_MAX_LENGTH];
+  uint8_t crc;
+  if (Serial.readBytes((char *)header, sizeof(header)) != sizeof(header))
+    return;
+  size_t length = header[1] | (header[2] << 8);
+  if (length > sizeof(batch) ||
+      Serial.readBytes((char *)batch, length) != length ||
+      Serial.readBytes((char *)&crc, 1) != 1 ||
+      crc != frameCrc(batch, length))
+  {
+    writeFrame(NULL, 0);
+    return;
+  }
+  uint8_t results[CMD_MAX_LENGTH];
+  int written = runBatch(batch, length, results, sizeof(results));
+  writeFrame(results, written > 0 ? written : 0);
+}
@@ -8,27 +8,94 @@
 
 #define HW_VERSION V4
 
+// Sensors fitted, the columns of the sensors that are not fitted are left out of the Data record
 #define OPC_ENABLED TRUE
+#define TEMP_ENABLED TRUE
 #define IR_ENABLED FALSE
+#define GAS_ENABLED TRUE
+#define NOISE_ENABLED TRUE
 #define CELLULAR_ON_STARTUP TRUE
 #define DTIME 100 
 
-#define HARVARD_PILOT FALSE         //Is this an Harvard pilot device?
+#define HARVARD_PILOT FALSE         //Is this an Harvard pilot device? (no IR and noise sensors)
 #define OLD_TEMPERATURE_SENSOR FALSE
+#define GAS_OVERSAMPLE 4            //ADS7828 conversions averaged per gas channel and sample (1..16)
+#define GAS_SAMPLER TRUE            //Sample the gas sensors in the background and report min/max/stddev per record
+#define GAS_SAMPLE_RATE 20          //Hz, background gas sampling rate (10..50)
+#define GAS_DECIMATION 10           //Samples per filtered gas value (2Hz at 20Hz)
+#define GAS_CALIBRATION TRUE        //Append the gas concentrations (ppb) computed with the SD calibration file
+#define GAS_CALIBRATED_OUTPUT FALSE //Send only the gas concentrations instead of the ADC values
+#define GAS_CAL_FILE "gascal.txt"   //SD file holding the gas sensor coefficients and nT tables
+#define GAS_VREF_MV 3300            //ADS7828 external reference in mV
 #define BATT_ENABLED TRUE
 
-#define OPC_DATA_VERSION EXTENDED       // BASE or EXTENDED for full BIN data
+#define OPC_DATA_VERSION EXTENDED       // BASE drops the number concentrations, EXTENDED sends all the SPS30 values
+#define PM_HUMIDITY_CORRECTION TRUE     //Correct the PM mass for the particle water uptake (kappa-Koehler)
+#define PM_KAPPA 0.3                    //Hygroscopicity of the urban aerosol
+#define PM_RH_MAX 95                    //%, the humidity is clamped here, the correction diverges near saturation
 #define TCP_GHOSTWRITE FALSE         //For testing purpose, doesn't dump data over TCP but prints it over serial
 #define SD_FORMAT_ONSTARTUP FALSE   //Erase SD Card on startup
+#define PROFILER TRUE               //Time the loop phases, see the "profile" CLI command
+#define TRACE_ENABLED TRUE          //Keep hot path events in a RAM ring instead of printing them, see the "trace" CLI command
+#define STATS_RECORD TRUE           //Log a Stats record (loop time, SD, upload, I2C errors, uptime) every ROUTINE_RATE
+#define HEAP_MONITOR TRUE           //Report heap use and fragmentation in the vitals record
+#define I2C_TRACE TRUE              //Report the I2C counters per device in the vitals record
 
 // Data sampling
 #define SAMPLE_RATE 5 //Seconds (for harvard 5s)
 #define VITALS_RATE 30 //Seconds
 #define ROUTINE_RATE 60 //seconds
 
+// Location
+#define GPS_NMEA_FILTER TRUE        //Skip NMEA sentences that are not decoded (GSV, GSA, VTG, ...)
+#define DEAD_RECKONING TRUE         //Interpolate positions between GNSS fixes using speed/course and the accelerometer
+#define DR_MAX_INTERVAL 30          //Seconds, stop interpolating when the last fix is older than this
+#define DR_FORWARD_AXIS X           //Accelerometer axis aligned with the direction of travel (X, Y or Z)
+#define DR_STILL_TIME 5             //Seconds without motion interrupts after which the vehicle is considered stopped
+#define GPS_PROFILES TRUE           //Switch the GNSS to power-save while parked
+#define GPS_PARKED_TIME 60          //Seconds without motion before the GNSS switches to power-save
+#define GPS_PARKED_UPDATE 60        //Seconds between fixes while parked (cyclic tracking)
+#define GPS_PROFILE_RETRY 10        //Seconds before a profile the GNSS did not acknowledge is sent again
+#define GNSS_WARM_START TRUE        //Keep last fix and navigation database across sleep, restore on wake
+#define GNSS_DBD_FILE "gnss.dbd"    //SD file holding the u-blox navigation database (MGA-DBD)
+#define GNSS_WARM_POS_ACC 300       //Meters, accuracy reported with the restored position
+#define GNSS_DBD_SAVE_INTERVAL 300  //Seconds between navigation database saves while the GNSS has a fix
+#define GNSS_ASSIST_OFFLINE TRUE    //Inject pre-staged AssistNow Offline/Autonomous data from the SD card on start
+#define GNSS_ASSIST_FILE "mgaoffline.ubx" //SD file with the raw UBX aiding messages
+
+// Motion
+#define MOTION_PIPELINE TRUE        //Sample the accelerometer in the background and add vibration features to the Data record
+#define MOTION_SAMPLE_RATE 25       //Hz, 25 or 50
+#define MOTION_MOVING_RMS 0.02      //g, vibration level above which the vehicle is considered moving
+#define VIB_BANDS {2, 4, 7, 11}     //Hz, centre of each vibration band added to the Data record (below MOTION_SAMPLE_RATE/2)
+
 // Data Storage and Broadcasting
 #define RECORDS_PER_FILE 200 //standard is 200
+#define RECORD_HEADER TRUE          //Start every data file with the layout of each record type (names, types, units, scales)
+#define RECORD_BINARY FALSE         //Store typed binary records instead of CSV lines, see tools/record_decode.py
 #define LOW_BATTERY_THRESHOLD 3.80 //volt
+#define DUMP_JITTER 30              //Seconds, a dump requested without slot hint starts at a random time within this window
+#define DUMP_SLOT_LENGTH 20         //Seconds per slot of a dump slot hint (sd,dump,all,<slot>/<slots>)
+#define DUMP_RETRIES 5              //Failed dumps are retried this many times
+#define DUMP_BACKOFF_BASE 30        //Seconds before the first retry, doubled after every failure
+#define DUMP_BACKOFF_MAX 900        //Seconds, longest wait between two retries
+
+// Power sequencing
+#define RAIL_3V3_SETTLE 20          //ms after EN_3V before the 3V3 sensors are started
+#define RAIL_5V_SETTLE 100          //ms after EN_5V before the OPC is started
+#define RAIL_GPS_SETTLE 20          //ms after EN_3V_GPS before the GPS is started
+#define POWER_RETRY_INTERVAL 100    //ms between readiness probes of a sensor that is not ready yet
+#define POWER_TIMEOUT 10            //Seconds, sensors not ready by then are left stopped
+
+// Energy planner
+#define ENERGY_PLANNER TRUE         //Slow down sampling and turn the OPC off when the battery trend would cross LOW_BATTERY_THRESHOLD
+#define ENERGY_HISTORY 30           //Routine runs of battery/solar history used for the trend
+#define ENERGY_HORIZON 2            //Hours, how far ahead the battery voltage is projected
+#define ENERGY_SAVE_ENTER 0.10      //volt above LOW_BATTERY_THRESHOLD, a projection below it enters SAVE
+#define ENERGY_SAVE_EXIT 0.25       //volt above LOW_BATTERY_THRESHOLD, a projection above it goes back to NORMAL
+#define ENERGY_MIN_DWELL 30         //Routine runs a tier is kept before the planner can leave it (CRITICAL is never delayed)
+#define ENERGY_SAVE_FACTOR 3        //Sample rate is divided by this while saving energy
+#define ENERGY_SOLAR_CHARGING 10    //mA, solar current above which a low battery hibernates for 1 hour instead of 6
 
 
 #define TCP_ENDPOINT "127.0.0.1" //change the IP address to dump data over TCP
@@ -0,0 +1,107 @@
+#include "cityscanner_power.h"
+
+CityPower *CityPower::_instance = nullptr;
+
+const unsigned long rail_settle[CityPower::RAIL_COUNT] = {0, RAIL_3V3_SETTLE, RAIL_5V_SETTLE, RAIL_GPS_SETTLE};
+
+CityPower::CityPower() {}
+
+void CityPower::enableRail(uint8_t rail)
+{
+    switch (rail)
+    {
+    case RAIL_3V3:
+        CS_core::instance().enable3V3(TRUE);
+        break;
+    case RAIL_5V:
+        CS_core::instance().enable5V(TRUE);
+        break;
+    case RAIL_GPS:
+        CS_core::instance().enableGPS(TRUE);
+        break;
+    default:
+        return;
+    }
+    if(!rail_on[rail])
+    {
+        rail_on[rail] = true;
+        rail_on_time[rail] = millis();
+    }
+}
+
+void CityPower::disableRail(uint8_t rail)
+{
+    switch (rail)
+    {
+    case RAIL_3V3:
+        CS_core::instance().enable3V3(FALSE);
+        break;
+    case RAIL_5V:
+        CS_core::instance().enable5V(FALSE);
+        break;
+    case RAIL_GPS:
+        CS_core::instance().enableGPS(FALSE);
+        break;
+    default:
+        return;
+    }
+    rail_on[rail] = false;
+}
+
+bool CityPower::railStable(uint8_t rail)
+{
+    if(rail == RAIL_NONE)
+        return true;
+    return rail_on[rail] && millis() - rail_on_time[rail] >= rail_settle[rail];
+}
+
+void CityPower::addStep(const char *name, uint8_t rail, std::function<bool(void)> start)
+{
+    if(step_count >= MAX_POWER_STEPS)
+        return;
+    steps[step_count].name = name;
+    steps[step_count].rail = rail;
+    steps[step_count].start = start;
+    steps[step_count].next_try = 0;
+    steps[step_count].ready = false;
+    step_count++;
+}
+
+void CityPower::clear()
+{
+    step_count = 0;
+}
+
+// Starts every queued sensor as soon as its rail has settled, then retries its readiness probe
+// every POWER_RETRY_INTERVAL. Sensors on different rails come up interleaved instead of one
+// after the other with fixed delays. Returns the number of sensors that are ready.
+int CityPower::run()
+{
+    unsigned long start_time = millis();
+    uint8_t ready_count = 0;
+
+    while(ready_count < step_count && millis() - start_time < POWER_TIMEOUT * 1000UL)
+    {
+        for(uint8_t i = 0; i < step_count; i++)
+        {
+            PowerStep &step = steps[i];
+            if(step.ready || !railStable(step.rail) || millis() < step.next_try)
+                continue;
+            step.ready = step.start();
+            if(step.ready)
+            {
+                ready_count++;
+                Log.info("%s ready after %lu ms", step.name, millis() - start_time);
+            }
+            else
+                step.next_try = millis() + POWER_RETRY_INTERVAL;
+        }
+        delay(1);
+    }
+
+    for(uint8_t i = 0; i < step_count; i++)
+        if(!steps[i].ready)
+            Log.info("%s not ready after %u s", steps[i].name, POWER_TIMEOUT);
+    clear();
+    return ready_count;
+}
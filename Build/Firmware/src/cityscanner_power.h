@@ -0,0 +1,57 @@
+#pragma once
+#include "Particle.h"
+#include "cityscanner_CONFIG.h"
+#include "CS_core.h"
+
+#define MAX_POWER_STEPS 10
+
+class CityPower {
+    public:
+        static CityPower &instance() {
+            if(!_instance) {
+                _instance = new CityPower();
+            }
+            return *_instance;
+        }
+
+        enum Rails
+        {
+            RAIL_NONE,
+            RAIL_3V3,
+            RAIL_5V,
+            RAIL_GPS,
+            RAIL_COUNT
+        };
+
+        void enableRail(uint8_t rail);
+        void disableRail(uint8_t rail);
+        bool railStable(uint8_t rail);
+
+        /**
+         * @brief Queue a sensor start for run()
+         *
+         * @param name used in the log
+         * @param rail the sensor is not started before this rail has settled
+         * @param start starts the sensor and returns true once its readiness probe succeeds
+         */
+        void addStep(const char *name, uint8_t rail, std::function<bool(void)> start);
+        int run(void);
+        void clear(void);
+
+    private:
+        CityPower();
+        static CityPower* _instance;
+
+        struct PowerStep
+        {
+            const char *name;
+            uint8_t rail;
+            std::function<bool(void)> start;
+            unsigned long next_try;     // millis() of the next readiness probe
+            bool ready;
+        };
+        PowerStep steps[MAX_POWER_STEPS];
+        uint8_t step_count = 0;
+        bool rail_on[RAIL_COUNT] = {true, false, false, false};
+        unsigned long rail_on_time[RAIL_COUNT] = {0, 0, 0, 0};   // millis() when the rail was switched on
+};
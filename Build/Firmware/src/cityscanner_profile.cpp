@@ -0,0 +1,79 @@
+#include "cityscanner_profile.h"
+
+CityProfile *CityProfile::_instance = nullptr;
+
+static const char *phase_names[CityProfile::PROFILE_COUNT] = {"loop", "sensors", "format", "store", "vitals", "location", "motion"};
+
+CityProfile::CityProfile() {
+    reset();
+}
+
+void CityProfile::reset()
+{
+    SINGLE_THREADED_BLOCK() {
+        memset(histogram, 0, sizeof(histogram));
+        memset(count, 0, sizeof(count));
+        memset(max_us, 0, sizeof(max_us));
+    }
+}
+
+// 0..3us map to their own bucket, above that the two bits below the leading one select
+// one of PROFILE_SUB_BUCKETS buckets in the octave (<= 25% error)
+uint8_t CityProfile::bucket(uint32_t us)
+{
+    if(us < PROFILE_SUB_BUCKETS)
+        return us;
+    uint8_t octave = 31 - __builtin_clz(us);
+    uint8_t index = (octave - 1) * PROFILE_SUB_BUCKETS + ((us >> (octave - 2)) & (PROFILE_SUB_BUCKETS - 1));
+    return index < PROFILE_BUCKETS ? index : PROFILE_BUCKETS - 1;
+}
+
+// Lower bound of the bucket in microseconds
+uint32_t CityProfile::bucketValue(uint8_t index)
+{
+    if(index < PROFILE_SUB_BUCKETS)
+        return index;
+    uint8_t octave = index / PROFILE_SUB_BUCKETS + 1;
+    return (uint32_t)(PROFILE_SUB_BUCKETS + index % PROFILE_SUB_BUCKETS) << (octave - 2);
+}
+
+void CityProfile::record(uint8_t phase, uint32_t ticks)
+{
+    if(phase >= PROFILE_COUNT)
+        return;
+    uint32_t us = ticks / System.ticksPerMicrosecond();
+    SINGLE_THREADED_BLOCK() {
+        histogram[phase][bucket(us)]++;
+        count[phase]++;
+        if(us > max_us[phase])
+            max_us[phase] = us;
+    }
+}
+
+uint32_t CityProfile::percentile(uint8_t phase, uint8_t percent)
+{
+    uint32_t target = ((uint64_t)count[phase] * percent + 99) / 100;
+    uint32_t seen = 0;
+    for(uint8_t i = 0; i < PROFILE_BUCKETS; i++)
+    {
+        seen += histogram[phase][i];
+        if(seen >= target)
+            return bucketValue(i);
+    }
+    return max_us[phase];
+}
+
+String CityProfile::report()
+{
+    String response = "";
+    for(uint8_t phase = 0; phase < PROFILE_COUNT; phase++)
+    {
+        if(count[phase] == 0)
+            continue;
+        if(response.length())
+            response += ";";
+        response += String::format("%s:%lu,%lu,%lu,%lu,%lu", phase_names[phase], count[phase],
+                                   percentile(phase, 50), percentile(phase, 90), percentile(phase, 99), max_us[phase]);
+    }
+    return response.length() ? response : "na";
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "Particle.h"
+#include "cityscanner_CONFIG.h"
+
+// Log-linear histogram: 4 buckets per power of two of microseconds, up to ~33s
+#define PROFILE_SUB_BUCKETS 4
+#define PROFILE_BUCKETS 100
+
+class CityProfile {
+    public:
+        static CityProfile &instance() {
+            if(!_instance) {
+                _instance = new CityProfile();
+            }
+            return *_instance;
+        }
+
+        enum Phases
+        {
+            PROFILE_LOOP,       // whole Cityscanner::loop()
+            PROFILE_SENSORS,    // sensor reads for the data record
+            PROFILE_FORMAT,     // String::format of the data record
+            PROFILE_STORE,      // CityStore::logData
+            PROFILE_VITALS,     // vitals record
+            PROFILE_LOCATION,   // locationService.loop()
+            PROFILE_MOTION,     // motionService.loop()
+            PROFILE_COUNT
+        };
+
+        void record(uint8_t phase, uint32_t ticks);
+        void reset(void);
+
+        /**
+         * @brief One entry per phase that ran: name:count,p50,p90,p99,max (microseconds)
+         */
+        String report(void);
+        uint32_t percentile(uint8_t phase, uint8_t percent);
+        uint32_t maximum(uint8_t phase) { return max_us[phase]; }
+
+    private:
+        CityProfile();
+        static CityProfile* _instance;
+        static uint8_t bucket(uint32_t us);
+        static uint32_t bucketValue(uint8_t index);
+
+        uint32_t histogram[PROFILE_COUNT][PROFILE_BUCKETS];
+        uint32_t count[PROFILE_COUNT];
+        uint32_t max_us[PROFILE_COUNT];
+};
+
+// Records the time spent until the end of the enclosing scope, System.ticks() is the cycle counter
+class ProfileScope {
+    public:
+        ProfileScope(uint8_t phase) : phase(phase), start(System.ticks()) {}
+        ~ProfileScope() { CityProfile::instance().record(phase, System.ticks() - start); }
+    private:
+        uint8_t phase;
+        uint32_t start;
+};
+
+#if PROFILER
+#define PROFILE_SCOPE(phase) ProfileScope profile_scope_##phase(CityProfile::phase)
+#else
+#define PROFILE_SCOPE(phase)
+#endif
@@ -0,0 +1,319 @@
+#include "cityscanner_schema.h"
+#include "cityscanner_sensors.h"
+#include "cityscanner_sense.h"
+#include "cityscanner_store.h"
+#include "cityscanner_settings.h"
+
+CitySchema *CitySchema::_instance = nullptr;
+
+static const char *type_names[FIELD_TYPE_COUNT] = {"u8", "u16", "u32", "i16", "i32", "f32", "str"};
+static const uint8_t field_sizes[FIELD_TYPE_COUNT] = {1, 2, 4, 2, 4, 4, 0};    // bytes, text is sized by its length
+
+// Same bands as MotionService::getVIBRATIONdata()
+static const int vib_bands[] = VIB_BANDS;
+
+#define GROUP(fields) {fields, sizeof(fields) / sizeof(fields[0])}
+
+// Written by CityStore::logData() in front of every record
+static const SchemaField prefix_fields[] = {
+    {"payload_type", FIELD_U8, "", 1, 1},
+    {"device_id", FIELD_STR, "", 1, 1},
+    {"timestamp", FIELD_U32, "s", 1, 1},
+    {"latitude", FIELD_I32, "deg", 1e6, 1},
+    {"longitude", FIELD_I32, "deg", 1e6, 1},
+};
+
+// Data, in the order of Cityscanner::loop()
+static const SchemaField opc_mass_fields[] = {
+    {"PM1", FIELD_U16, "ug/m3", 10, 1},
+    {"PM25", FIELD_U16, "ug/m3", 10, 1},
+    {"PM4", FIELD_U16, "ug/m3", 10, 1},
+    {"PM10", FIELD_U16, "ug/m3", 10, 1},
+};
+static const SchemaField opc_number_fields[] = {
+    {"num_PM05", FIELD_U16, "1/cm3", 10, 1},
+    {"num_PM1", FIELD_U16, "1/cm3", 10, 1},
+    {"num_PM25", FIELD_U16, "1/cm3", 10, 1},
+    {"num_PM4", FIELD_U16, "1/cm3", 10, 1},
+    {"num_PM10", FIELD_U16, "1/cm3", 10, 1},
+};
+static const SchemaField opc_derived_fields[] = {
+    {"particle_size", FIELD_U16, "um", 1000, 1},
+    {"PM_coarse", FIELD_I16, "ug/m3", 10, 1},
+    {"PM25_PM10_ratio", FIELD_U16, "", 1000, 1},
+    {"PM_growth", FIELD_U16, "", 1000, 1},
+};
+static const SchemaField temp_fields[] = {
+    {"temperature", FIELD_I16, "C", 100, 1},
+    {"humidity", FIELD_U16, "%", 100, 1},
+};
+static const SchemaField ir_fields[] = {
+    {"ambient_IR", FIELD_I16, "C", 10, 1},
+    {"object_IR", FIELD_I16, "C", 10, 1},
+};
+static const SchemaField gas_fields[] = {
+    {"gas_op1_w", FIELD_U16, "mV", 1, 1},
+    {"gas_op1_r", FIELD_U16, "mV", 1, 1},
+    {"gas_op2_w", FIELD_U16, "mV", 1, 1},
+    {"gas_op2_r", FIELD_U16, "mV", 1, 1},
+};
+static const SchemaField gas_stats_fields[] = {
+    {"gas_op1_w_min", FIELD_U16, "mV", 1, 1},
+    {"gas_op1_w_max", FIELD_U16, "mV", 1, 1},
+    {"gas_op1_w_sd", FIELD_U16, "mV", 10, 1},
+    {"gas_op1_r_min", FIELD_U16, "mV", 1, 1},
+    {"gas_op1_r_max", FIELD_U16, "mV", 1, 1},
+    {"gas_op1_r_sd", FIELD_U16, "mV", 10, 1},
+    {"gas_op2_w_min", FIELD_U16, "mV", 1, 1},
+    {"gas_op2_w_max", FIELD_U16, "mV", 1, 1},
+    {"gas_op2_w_sd", FIELD_U16, "mV", 10, 1},
+    {"gas_op2_r_min", FIELD_U16, "mV", 1, 1},
+    {"gas_op2_r_max", FIELD_U16, "mV", 1, 1},
+    {"gas_op2_r_sd", FIELD_U16, "mV", 10, 1},
+};
+static const SchemaField gas_ppb_fields[] = {
+    {"gas_sn1_ppb", FIELD_I32, "ppb", 10, 1},
+    {"gas_sn2_ppb", FIELD_I32, "ppb", 10, 1},
+};
+static const SchemaField noise_fields[] = {
+    {"noise", FIELD_U16, "", 1, 1},
+};
+static const SchemaField motion_fields[] = {
+    {"fix_type", FIELD_U8, "", 1, 1},
+    {"vib_rms", FIELD_U16, "g", 1000, 1},
+    {"jerk_max", FIELD_U16, "g/s", 100, 1},
+    {"motion_starts", FIELD_U16, "", 1, 1},
+    {"motion_stops", FIELD_U16, "", 1, 1},
+    {"moving", FIELD_U8, "", 1, 1},
+    {"vib_band", FIELD_U16, "mg", 1, sizeof(vib_bands) / sizeof(vib_bands[0])},
+};
+
+static const SchemaField vitals_fields[] = {
+    {"SOC_batt", FIELD_U8, "%", 1, 1},
+    {"temp_batt", FIELD_I16, "C", 10, 1},
+    {"voltage_batt", FIELD_U16, "V", 100, 1},
+    {"voltage_particle", FIELD_U16, "V", 100, 1},
+    {"current_batt", FIELD_I16, "mA", 1, 1},
+    {"isCharging", FIELD_U8, "", 1, 1},
+    {"isCharged", FIELD_U8, "", 1, 1},
+    {"temp_int", FIELD_I16, "C", 100, 1},
+    {"hum_int", FIELD_U16, "%", 100, 1},
+    {"voltage_solar", FIELD_U16, "V", 100, 1},
+    {"current_solar", FIELD_I16, "mA", 10, 1},
+    {"cell_strength", FIELD_U16, "%", 10, 1},
+    {"i2c", FIELD_STR, "", 1, 1},
+    {"heap_used", FIELD_U32, "B", 1, 1},
+    {"heap_peak", FIELD_U32, "B", 1, 1},
+    {"heap_free", FIELD_U32, "B", 1, 1},
+    {"heap_largest_block", FIELD_U32, "B", 1, 1},
+    {"heap_free_chunks", FIELD_U16, "", 1, 1},
+};
+
+static const SchemaField warning_fields[] = {
+    {"message", FIELD_STR, "", 1, 1},
+};
+
+static const SchemaField stats_fields[] = {
+    {"loop_p50", FIELD_U32, "us", 1, 1},
+    {"loop_p99", FIELD_U32, "us", 1, 1},
+    {"loop_max", FIELD_U32, "us", 1, 1},
+    {"sd_write_avg", FIELD_U32, "us", 1, 1},
+    {"sd_write_max", FIELD_U32, "us", 1, 1},
+    {"queued_files", FIELD_U16, "", 1, 1},
+    {"queued_bytes", FIELD_U32, "B", 1, 1},
+    {"upload_rate", FIELD_U32, "B/s", 1, 1},
+    {"i2c_errors", FIELD_U32, "", 1, 1},
+    {"uptime", FIELD_U32, "s", 1, 1},
+};
+
+CitySchema::CitySchema() {}
+
+uint8_t CitySchema::layout(uint8_t payload_type, SchemaGroup *groups)
+{
+    uint8_t n = 0;
+    groups[n++] = GROUP(prefix_fields);
+    switch (payload_type)
+    {
+    case Data:
+        if (SENSORS.opc)
+        {
+            groups[n++] = GROUP(opc_mass_fields);
+            if (HARVARD_PILOT || CitySettings::instance().get().opc_data_version == EXTENDED)
+                groups[n++] = GROUP(opc_number_fields);
+            groups[n++] = GROUP(opc_derived_fields);
+        }
+        if (SENSORS.temp)
+            groups[n++] = GROUP(temp_fields);
+        if (SENSORS.ir)
+            groups[n++] = GROUP(ir_fields);
+        if (SENSORS.gas)
+        {
+            if (!GAS_CALIBRATED_OUTPUT)
+            {
+                groups[n++] = GROUP(gas_fields);
+                if (GAS_SAMPLER)
+                    groups[n++] = GROUP(gas_stats_fields);
+            }
+            if (GAS_CALIBRATED_OUTPUT || GAS_CALIBRATION)
+                groups[n++] = GROUP(gas_ppb_fields);
+        }
+        if (SENSORS.noise)
+            groups[n++] = GROUP(noise_fields);
+        groups[n++] = GROUP(motion_fields);
+        break;
+    case Vitals:
+        groups[n++] = GROUP(vitals_fields);
+        break;
+    case Warning:
+        groups[n++] = GROUP(warning_fields);
+        break;
+    case Stats:
+        groups[n++] = GROUP(stats_fields);
+        break;
+    default:
+        break;
+    }
+    return n;
+}
+
+uint16_t CitySchema::columns(uint8_t payload_type)
+{
+    SchemaGroup groups[SCHEMA_MAX_GROUPS];
+    uint8_t count = layout(payload_type, groups);
+    uint16_t columns = 0;
+    for (uint8_t g = 0; g < count; g++)
+        for (uint8_t f = 0; f < groups[g].count; f++)
+            columns += max(groups[g].fields[f].repeat, (uint8_t)1);
+    return columns;
+}
+
+size_t CitySchema::maxLength(uint8_t payload_type)
+{
+    SchemaGroup groups[SCHEMA_MAX_GROUPS];
+    uint8_t count = layout(payload_type, groups);
+    size_t length = 2;
+    for (uint8_t g = 0; g < count; g++)
+        for (uint8_t f = 0; f < groups[g].count; f++)
+        {
+            const SchemaField &field = groups[g].fields[f];
+            size_t size = field.type == FIELD_STR ? FIELD_MAX_TEXT + 1 : field_sizes[field.type];
+            length += size * max(field.repeat, (uint8_t)1);
+        }
+    return length;
+}
+
+String CitySchema::header(uint8_t payload_type)
+{
+    SchemaGroup groups[SCHEMA_MAX_GROUPS];
+    uint8_t count = layout(payload_type, groups);
+    String header = String::format("#%u", payload_type);
+    for (uint8_t g = 0; g < count; g++)
+        for (uint8_t f = 0; f < groups[g].count; f++)
+        {
+            const SchemaField &field = groups[g].fields[f];
+            for (uint8_t r = 1; r <= max(field.repeat, (uint8_t)1); r++)
+            {
+                String name = field.repeat > 1 ? String::format("%s%u", field.name, r) : String(field.name);
+                header += String::format(",%s:%s:%s:%g", name.c_str(), type_names[field.type], field.unit, field.scale);
+            }
+        }
+    return header;
+}
+
+// A text field at the end of a record takes the rest of the line, warnings may hold commas
+bool CitySchema::matches(uint8_t payload_type, const String &record)
+{
+    uint16_t found = 1;
+    for (unsigned int i = 0; i < record.length(); i++)
+        if (record.charAt(i) == ',')
+            found++;
+    uint16_t expected = columns(payload_type);
+    return found == expected || (payload_type == Warning && found > expected);
+}
+
+size_t CitySchema::encode(uint8_t payload_type, const String &record, uint8_t *buffer, size_t size)
+{
+    SchemaGroup groups[SCHEMA_MAX_GROUPS];
+    uint8_t count = layout(payload_type, groups);
+    const char *text = record.c_str();
+    size_t length = 2;
+    if (size < length)
+        return 0;
+
+    for (uint8_t g = 0; g < count; g++)
+        for (uint8_t f = 0; f < groups[g].count; f++)
+        {
+            const SchemaField &field = groups[g].fields[f];
+            for (uint8_t r = 0; r < max(field.repeat, (uint8_t)1); r++)
+            {
+                if (!text)
+                    return 0;   // fewer columns than the layout
+                bool last = (g == count - 1) && (f == groups[g].count - 1) && (r + 1 >= field.repeat);
+                const char *comma = (last && field.type == FIELD_STR) ? NULL : strchr(text, ',');
+                size_t column = comma ? comma - text : strlen(text);
+                size_t written = encodeField(field.type, field.scale, text, column, buffer + length, size - length);
+                if (!written)
+                    return 0;
+                length += written;
+                text = comma ? comma + 1 : NULL;
+            }
+        }
+    if (text)
+        return 0;   // more columns than the layout
+    buffer[0] = length & 0xFF;
+    buffer[1] = length >> 8;
+    return length;
+}
+
+size_t CitySchema::encodeField(uint8_t type, float scale, const char *text, size_t length, uint8_t *out, size_t size)
+{
+    if (type == FIELD_STR)
+    {
+        length = min(length, (size_t)FIELD_MAX_TEXT);
+        if (size < length + 1)
+            return 0;
+        out[0] = length;
+        memcpy(out + 1, text, length);
+        return length + 1;
+    }
+
+    if (size < field_sizes[type])
+        return 0;
+
+    char number[24];
+    length = min(length, sizeof(number) - 1);
+    memcpy(number, text, length);
+    number[length] = '\0';
+    char *end;
+    double value = strtod(number, &end);
+    bool na = end == number;
+
+    uint32_t bits;
+    switch (type)
+    {
+    case FIELD_F32:
+    {
+        float f = na ? NAN : value;
+        memcpy(&bits, &f, sizeof(bits));
+        break;
+    }
+    case FIELD_I16:
+    case FIELD_I32:
+    {
+        double limit = type == FIELD_I16 ? INT16_MAX : INT32_MAX;
+        double scaled = constrain(round(value * scale), -limit, limit);
+        bits = na ? (uint32_t)(int32_t)(-limit - 1) : (uint32_t)(int32_t)scaled;
+        break;
+    }
+    default:
+    {
+        double limit = type == FIELD_U8 ? UINT8_MAX - 1 : type == FIELD_U16 ? UINT16_MAX - 1 : UINT32_MAX - 1;
+        double scaled = constrain(round(value * scale), 0.0, limit);
+        bits = na ? (uint32_t)(limit + 1) : (uint32_t)scaled;
+        break;
+    }
+    }
+    for (uint8_t i = 0; i < field_sizes[type]; i++)
+        out[i] = bits >> (8 * i);
+    return field_sizes[type];
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "Particle.h"
+#include "cityscanner_CONFIG.h"
+
+#define SCHEMA_MAX_GROUPS 12
+#define FIELD_MAX_TEXT 255      //characters, text fields longer than this are cut
+
+// Types of the binary fields, keep in sync with tools/record_decode.py
+enum FieldType
+{
+    FIELD_U8,
+    FIELD_U16,
+    FIELD_U32,
+    FIELD_I16,
+    FIELD_I32,
+    FIELD_F32,
+    FIELD_STR,      // length byte + characters
+    FIELD_TYPE_COUNT
+};
+
+// One column of a record. Binary records hold round(value * scale) in the field type,
+// "na" is the largest value of unsigned types, the smallest of signed types and NaN for f32
+struct SchemaField
+{
+    const char *name;
+    uint8_t type;
+    const char *unit;
+    float scale;
+    uint8_t repeat;     // >1: columns name1..nameN
+};
+
+// Consecutive columns written by one getter
+struct SchemaGroup
+{
+    const SchemaField *fields;
+    uint8_t count;
+};
+
+class CitySchema {
+    public:
+        static CitySchema &instance() {
+            if(!_instance) {
+                _instance = new CitySchema();
+            }
+            return *_instance;
+        }
+
+        /**
+         * @brief Columns of a record type with the current configuration and settings
+         *
+         * @param payload_type Data, Vitals, Warning or Stats
+         * @retval number of groups written to groups
+         */
+        uint8_t layout(uint8_t payload_type, SchemaGroup *groups);
+        uint16_t columns(uint8_t payload_type);
+
+        /**
+         * @brief Largest binary record of a type, length included, with every text field at FIELD_MAX_TEXT
+         */
+        size_t maxLength(uint8_t payload_type);
+
+        /**
+         * @brief Header line of a record type: #<payload_type>,name:type:unit:scale,...
+         */
+        String header(uint8_t payload_type);
+
+        /**
+         * @brief Check the number of columns of a CSV record against its layout
+         */
+        bool matches(uint8_t payload_type, const String &record);
+
+        /**
+         * @brief Typed binary record from a CSV record: uint16 length then the fields, little endian
+         *
+         * @retval length of the binary record, 0 if the record does not match the layout
+         */
+        size_t encode(uint8_t payload_type, const String &record, uint8_t *buffer, size_t size);
+
+    private:
+        CitySchema();
+        static CitySchema* _instance;
+        static size_t encodeField(uint8_t type, float scale, const char *text, size_t length, uint8_t *out, size_t size);
+};
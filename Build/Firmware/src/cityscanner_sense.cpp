@@ -8,6 +8,7 @@
 #include "Adafruit_MLX90614.h"
 #include "sps30.h"
 #include <i2c_adc_ads7828.h>
+#include "cityscanner_calibration.h"
 
 CitySense *CitySense::_instance = nullptr;
 
@@ -39,19 +40,20 @@ CitySense::CitySense() {}
 
 int CitySense::init()
 {   
-    if(!TEMPext_started)
+    if(SENSORS.temp && !TEMPext_started)
         startTEMP();
     delay(DTIME);
-    if(!NOISE_started)
+    if(SENSORS.noise && !NOISE_started)
         startNOISE();
     delay(DTIME);
-    if(!GAS_started)
+    if(SENSORS.gas && !GAS_started)
         startGAS();
     delay(DTIME);
-    if(!OPC_started && OPC_ENABLED)
+    if(SENSORS.opc && !OPC_started)
         startOPC();
     delay(DTIME);
-    startIR();
+    if(SENSORS.ir)
+        startIR();
     return 1;
 }
 
@@ -76,11 +78,16 @@ bool CitySense::startOPC()
 {
     //CS_core::instance().enableOPC(1);
     //myOPCN3.initialize();
+    // The Wire lock keeps the motion and gas threads off the bus while the main thread talks to a sensor
+    bool probed = false;
+    WITH_LOCK(Wire) {
     if (!sps30.begin(SP30_COMMS))
       Serial.println("could not initialize communication channel.");
+    probed = sps30.probe();
+    }
 
     // check for SPS30 connection
-    if (!sps30.probe()) {
+    if (!probed) {
         Serial.println("could not probe / connect with SPS30.");
         OPC_started = false;
         return 0;
@@ -134,7 +141,9 @@ bool CitySense::startOPC()
 }
 
 bool CitySense::startIR(){
-    mlx1.begin();
+    WITH_LOCK(Wire) {
+        mlx1.begin();
+    }
     IR_started = true;
     return 1;
 }
@@ -148,7 +157,9 @@ String CitySense::getIRdata(){
     if(IR_started)
     {
         //mlx.begin(); 
-        return String::format("%.1f,%.1f", mlx1.readAmbientTempC(), mlx1.readObjectTempC());
+        WITH_LOCK(Wire) {
+            return String::format("%.1f,%.1f", mlx1.readAmbientTempC(), mlx1.readObjectTempC());
+        }
         /*double (Adafruit_MLX90614::)() ATC, OTC, ATF, OTF;
         ATC = mlx.readAmbientTempC;
         OTC = mlx.readObjectTempC;
@@ -172,7 +183,9 @@ String CitySense::getOPCdata(int option)
     if(OPC_started){
         do
         {
-            ret = sps30.GetValues(&val);
+            WITH_LOCK(Wire) {
+                ret = sps30.GetValues(&val);
+            }
             // data might not have been ready
             if (ret == SPS30_ERR_DATALENGTH)
             {
@@ -190,19 +203,26 @@ String CitySense::getOPCdata(int option)
             }
 
         } while (ret != ERR_OK); 
-        String opcdata = "na";
-
-        opcdata = String::format("%.2f", val.MassPM1) + "," + 
-              String::format("%.2f", val.MassPM2) + "," + 
-              String::format("%.2f", val.MassPM4) + "," +
-              String::format("%.2f", val.MassPM10) + "," + 
-              String::format("%.2f", val.NumPM0) + "," +
-              String::format("%.2f", val.NumPM1) + "," + 
-              String::format("%.2f", val.NumPM2) + "," +
-              String::format("%.2f", val.NumPM4) + "," + 
-              String::format("%.2f", val.NumPM10) + "," +
-              String::format("%.2f", val.PartSize);
-
+        // Humidity growth correction of the mass concentrations (kappa-Koehler, dry = wet / C)
+        float growth = getHumidityGrowth();
+        float mass_factor = isnan(growth) ? 1 : 1 / growth;
+        float pm1 = val.MassPM1 * mass_factor;
+        float pm25 = val.MassPM2 * mass_factor;
+        float pm4 = val.MassPM4 * mass_factor;
+        float pm10 = val.MassPM10 * mass_factor;
+        // particle diameter grows with the cube root of the water uptake
+        float size = val.PartSize * (isnan(growth) ? 1 : pow(mass_factor, 1.0F / 3));
+        String derived = String::format("%.2f,%s,%s", pm10 - pm25,
+                                        pm10 > 0 ? String::format("%.2f", pm25 / pm10).c_str() : "na",
+                                        isnan(growth) ? "na" : String::format("%.3f", growth).c_str());
+
+        String opcdata;
+        if(option == BASE)
+            opcdata = String::format("%.2f,%.2f,%.2f,%.2f,%.2f,%s", pm1, pm25, pm4, pm10, size, derived.c_str());
+        else
+            opcdata = String::format("%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%s", pm1, pm25, pm4, pm10,
+                                     val.NumPM0, val.NumPM1, val.NumPM2, val.NumPM4, val.NumPM10, size, derived.c_str());
+        last_opc_data = opcdata;
         return opcdata;
 
         /*uint16_t error;
@@ -287,7 +307,9 @@ String CitySense::getOPCdata(int option)
         return opcdata;*/
     
     } else {
-        return "na,na,na,na,na,na,na,na";
+        if(option == BASE)
+            return "na,na,na,na,na,na,na,na";
+        return "na,na,na,na,na,na,na,na,na,na,na,na,na";
         //return "na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na";
     }
 }
@@ -295,12 +317,16 @@ String CitySense::getOPCdata(int option)
 bool CitySense::startTEMP()
 {   
     Wire.begin();
+    WITH_LOCK(Wire) {
     if(OLD_TEMPERATURE_SENSOR)
+    {
      sht20.initSHT20();
+     TEMPext_started = true;
+    }
     else
-      Serial.println(tempext.beginI2C());
-    TEMPext_started = true;
-    return 1;
+      TEMPext_started = tempext.beginI2C(); // true once the BME280 answers with its chip ID
+    }
+    return TEMPext_started;
 }
 
 bool CitySense::stopTEMP()
@@ -309,14 +335,60 @@ bool CitySense::stopTEMP()
     return 1;
 }
 
+// Ambient temperature in C, NAN when the sensor is not started
+float CitySense::getTemperature()
+{
+    if(!TEMPext_started)
+        return NAN;
+    WITH_LOCK(Wire) {
+        if(OLD_TEMPERATURE_SENSOR)
+            return sht20.readTemperature();
+        return tempext.readTempC();
+    }
+    return NAN;
+}
+
+// Relative humidity in %, NAN when the sensor is not started
+float CitySense::getHumidity()
+{
+    if(!TEMPext_started)
+        return NAN;
+    WITH_LOCK(Wire) {
+        if(OLD_TEMPERATURE_SENSOR)
+            return sht20.readHumidity();
+        return tempext.readFloatHumidity();
+    }
+    return NAN;
+}
+
+// Mass growth factor of the particles at the ambient humidity, C = 1 + (kappa / 1.65) / (1 / aw - 1)
+// with the water activity aw = RH / 100 (1.65 = dry particle density over water density).
+// NAN when the correction is disabled or the humidity is not available.
+float CitySense::getHumidityGrowth()
+{
+    if(!PM_HUMIDITY_CORRECTION)
+        return NAN;
+    float rh = getHumidity();
+    if(isnan(rh))
+        return NAN;
+    if(rh > PM_RH_MAX)
+        rh = PM_RH_MAX;
+    if(rh <= 0)
+        return 1;
+    return 1 + (PM_KAPPA / 1.65F) / (100 / rh - 1);
+}
+
 String CitySense::getTEMPdata()
 {
     if(TEMPext_started)
     {
+    WITH_LOCK(Wire) {
     if(OLD_TEMPERATURE_SENSOR)
      return String::format("%.2f,%.2f", sht20.readTemperature(), sht20.readHumidity());
     else 
      return String::format("%.1f,%.1f", tempext.readTempC(), tempext.readFloatHumidity());   
+    }
+    return "na,na";
     } else
     return "na,na";
 }
@@ -342,7 +414,9 @@ bool CitySense::startGAS()
 {
     //gas.begin();
     // enable I2C communication
-    ADS7828::begin();
+    WITH_LOCK(Wire) {
+        ADS7828::begin();
+    }
 
     // adjust scaling on an individual channel basis
     adc0->minScale = 220;
@@ -357,8 +431,22 @@ bool CitySense::startGAS()
     adc3->minScale = 270;
     adc3->maxScale = 300;
 
-    GAS_started = true;
-    return 1;
+    // ready once the ADC acknowledges a conversion, start() returns the Wire status (0 = ACK)
+    WITH_LOCK(Wire) {
+        GAS_started = (adc->start(0) == 0);
+    }
+    if((GAS_CALIBRATION || GAS_CALIBRATED_OUTPUT) && !gas_calibration_read)
+    {
+        CityCalibration::instance().load(GAS_CAL_FILE);
+        gas_calibration_read = true;
+    }
+    if(GAS_SAMPLER && GAS_started)
+    {
+        resetGasFilter();
+        if(gas_thread == NULL)
+            gas_thread = new Thread("gas", gasThread, this, OS_THREAD_PRIORITY_DEFAULT, 1024);
+    }
+    return GAS_started;
 }
 
 bool CitySense::stopGAS()
@@ -367,6 +455,108 @@ bool CitySense::stopGAS()
     return 1;
 }
 
+// Samples adc0..adc3 at GAS_SAMPLE_RATE, the Wire lock is held for the whole scan
+void CitySense::gasThread(void *param)
+{
+    CitySense *sense = (CitySense *)param;
+    system_tick_t last_wake = millis();
+    uint16_t raw[GAS_CHANNELS];
+
+    while(true)
+    {
+        os_thread_delay_until(&last_wake, 1000 / GAS_SAMPLE_RATE);
+        if(!sense->GAS_started)
+            continue;
+
+        uint8_t count;
+        WITH_LOCK(Wire) {
+            count = adc->scan(0x0F, GAS_OVERSAMPLE);
+        }
+        if(count != GAS_CHANNELS)
+            continue;
+        for(int i = 0; i < GAS_CHANNELS; i++)
+            raw[i] = adc->channel(i)->sample();
+        sense->addGasSample(raw);
+        sense->gas_scans++;
+    }
+}
+
+// True once the gas thread completes a scan within a few sampling periods,
+// called after the power sequence to catch a sampler that never runs
+bool CitySense::gasSampling()
+{
+    if(!GAS_SAMPLER)
+        return GAS_started;
+    if(!GAS_started || gas_thread == NULL)
+        return false;
+    uint32_t scans = gas_scans;
+    unsigned long start = millis();
+    while(millis() - start < 4000UL / GAS_SAMPLE_RATE + 100)
+    {
+        if(gas_scans != scans)
+            return true;
+        delay(10);
+    }
+    return false;
+}
+
+void CitySense::resetGasFilter()
+{
+    SINGLE_THREADED_BLOCK() {
+        for(int i = 0; i < GAS_CHANNELS; i++)
+        {
+            cic_integrator1[i] = 0;
+            cic_integrator2[i] = 0;
+            cic_comb1[i] = 0;
+            cic_comb2[i] = 0;
+            gas_sum[i] = 0;
+            gas_sum_sq[i] = 0;
+        }
+        cic_phase = 0;
+        cic_warmup = 2;
+        gas_n = 0;
+    }
+}
+
+// Second order CIC decimator in integer arithmetic. The integrators run at GAS_SAMPLE_RATE
+// and are allowed to wrap, the combs run once every GAS_DECIMATION samples and the output
+// is divided by the DC gain (GAS_DECIMATION^2). Each output feeds the record statistics.
+void CitySense::addGasSample(const uint16_t *raw)
+{
+    SINGLE_THREADED_BLOCK() {
+        for(int i = 0; i < GAS_CHANNELS; i++)
+        {
+            cic_integrator1[i] += raw[i];
+            cic_integrator2[i] += cic_integrator1[i];
+        }
+        if(++cic_phase >= GAS_DECIMATION)
+        {
+            cic_phase = 0;
+            for(int i = 0; i < GAS_CHANNELS; i++)
+            {
+                uint32_t c1 = cic_integrator2[i] - cic_comb1[i];
+                cic_comb1[i] = cic_integrator2[i];
+                uint32_t c2 = c1 - cic_comb2[i];
+                cic_comb2[i] = c1;
+                if(cic_warmup)
+                    continue;
+
+                uint16_t out = c2 / (GAS_DECIMATION * GAS_DECIMATION);
+                if(gas_n == 0 || out < gas_min[i])
+                    gas_min[i] = out;
+                if(gas_n == 0 || out > gas_max[i])
+                    gas_max[i] = out;
+                gas_sum[i] += out;
+                gas_sum_sq[i] += (uint32_t)out * out;
+            }
+            if(cic_warmup)
+                cic_warmup--;
+            else
+                gas_n++;
+        }
+    }
+}
+
 String CitySense::getGASdata(){
     // TODO:Implement gas sensing in a non-blocking way
     if(GAS_started)
@@ -390,18 +580,99 @@ String CitySense::getGASdata(){
         sn1_r = adc1 * 0.1875F;
         sn2_w = adc2 * 0.1875F;
         sn2_r = adc3 * 0.1875F;*/
-        int16_t sn1_w,sn1_r,sn2_w,sn2_r;
-        ADS7828::updateAll();
-        sn2_w = adc0->value();
-        sn2_r = adc1->value(); 
-        sn1_w = adc2->value();
-        sn1_r = adc3->value();
-        //Serial.print("SN1_W : ");
-        //Serial.println(sn1_w);
-        String payload = "n/a";
-        payload = String::format("%d,%d,%d,%d", sn2_w,sn2_r,sn1_w,sn1_r);
+        String payload;
+        uint16_t raw[GAS_CHANNELS];     // unscaled counts for the calibration
+        if(GAS_SAMPLER)
+        {
+            // filtered mean per channel over the decimated values since the last record,
+            // then min,max,stddev per channel, all scaled like ADS7828Channel::value()
+            uint16_t n, min[GAS_CHANNELS], max[GAS_CHANNELS];
+            uint32_t sum[GAS_CHANNELS];
+            uint64_t sum_sq[GAS_CHANNELS];
+            SINGLE_THREADED_BLOCK() {
+                n = gas_n;
+                for(int i = 0; i < GAS_CHANNELS; i++)
+                {
+                    min[i] = gas_min[i];
+                    max[i] = gas_max[i];
+                    sum[i] = gas_sum[i];
+                    sum_sq[i] = gas_sum_sq[i];
+                    gas_sum[i] = 0;
+                    gas_sum_sq[i] = 0;
+                }
+                gas_n = 0;
+            }
+            if(n == 0)
+                return gasNA();
+
+            String means = "";
+            String stats = "";
+            for(int i = 0; i < GAS_CHANNELS; i++)
+            {
+                ADS7828Channel *ch = adc->channel(i);
+                float scale = (float)(ch->maxScale - ch->minScale) / DEFAULT_MAX_SCALE;
+                float mean = (float)sum[i] / n;
+                // n * sum_sq - sum^2 is exact in 64 bits, a float difference of two ~1e7 terms is not
+                uint64_t spread = (uint64_t)n * sum_sq[i] - (uint64_t)sum[i] * sum[i];
+                float var = (double)spread / ((double)n * n);
+                raw[i] = mean + 0.5F;
+                means += String::format(i ? ",%d" : "%d", (int)(ch->minScale + mean * scale + 0.5F));
+                stats += String::format(",%d,%d,%.1f", (int)(ch->minScale + min[i] * scale + 0.5F),
+                                                       (int)(ch->minScale + max[i] * scale + 0.5F),
+                                                       var > 0 ? sqrt(var) * scale : 0.0F);
+            }
+            payload = means + stats;
+        }
+        else
+        {
+        int16_t op1_w,op1_r,op2_w,op2_r;
+        WITH_LOCK(Wire) {
+            adc->scan(0x0F, GAS_OVERSAMPLE); // adc0..adc3 only
+        }
+        op1_w = adc0->value();
+        op1_r = adc1->value(); 
+        op2_w = adc2->value();
+        op2_r = adc3->value();
+        //Serial.print("OP1_W : ");
+        //Serial.println(op1_w);
+        payload = String::format("%d,%d,%d,%d", op1_w,op1_r,op2_w,op2_r);
+        for(int i = 0; i < GAS_CHANNELS; i++)
+            raw[i] = adc->channel(i)->total() >> 4; // moving average before scaling
+        }
+        if(GAS_CALIBRATED_OUTPUT)
+            return getCalibratedGAS(raw);
+        if(GAS_CALIBRATION)
+        {
+            payload += ",";
+            payload += getCalibratedGAS(raw);
+        }
         return payload;
         }
      } else
-    return "na,na,na,na";
+    return gasNA();
+}
+
+// Empty gas columns, their number follows the configuration
+String CitySense::gasNA()
+{
+    if(GAS_CALIBRATED_OUTPUT)
+        return "na,na";
+    String na = GAS_SAMPLER ? "na,na,na,na,na,na,na,na,na,na,na,na,na,na,na,na" : "na,na,na,na";
+    if(GAS_CALIBRATION)
+        na += ",na,na";
+    return na;
+}
+
+// sn1_ppb,sn2_ppb from the unscaled counts, temperature compensated with the BME280.
+// Sensor 1 is on gas_op1 (adc0/adc1), sensor 2 on gas_op2 (adc2/adc3)
+String CitySense::getCalibratedGAS(const uint16_t *raw)
+{
+    CityCalibration &calibration = CityCalibration::instance();
+    float temperature = getTemperature();
+    if(isnan(temperature))
+        return "na,na";
+    int16_t t = temperature * 100;
+    String sn1 = calibration.loaded(1) ? String::format("%.1f", calibration.ppb(1, raw[0], raw[1], t) / 10.0F) : "na";
+    String sn2 = calibration.loaded(2) ? String::format("%.1f", calibration.ppb(2, raw[2], raw[3], t) / 10.0F) : "na";
+    return sn1 + "," + sn2;
 }
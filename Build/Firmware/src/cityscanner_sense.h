@@ -1,8 +1,10 @@
 #pragma once
 #include "cityscanner_CONFIG.h"
+#include "cityscanner_sensors.h"
 #include "Particle.h"
 #define BASE 0 
 #define EXTENDED 1 
+#define GAS_CHANNELS 4 //adc0..adc3
 
 
 class CitySense {
@@ -30,6 +32,9 @@ class CitySense {
         bool stopTEMP(void); 
         bool TEMPext_started = false;
         String getTEMPdata(void);
+        float getTemperature(void);
+        float getHumidity(void);
+        float getHumidityGrowth(void);
         bool startNOISE(void);
         bool stopNOISE(void);
         bool NOISE_started = false;
@@ -38,6 +43,7 @@ class CitySense {
         bool stopGAS(void);
         bool GAS_started = false;
         String getGASdata(void);
+        bool gasSampling(void);
         bool startIR(void);
         bool stopIR(void);
         bool IR_started = false;
@@ -48,4 +54,25 @@ class CitySense {
     private:
         CitySense();
         static CitySense* _instance;
+        static void gasThread(void *param);
+        void resetGasFilter(void);
+        void addGasSample(const uint16_t *raw);
+        String gasNA(void);
+        String getCalibratedGAS(const uint16_t *raw);
+        Thread *gas_thread = NULL;
+        volatile uint32_t gas_scans = 0;    // complete scans of the gas thread since boot
+        bool gas_calibration_read = false;  // GAS_CAL_FILE is read once, not on every startGAS() retry
+        // Second order CIC decimator, one output every GAS_DECIMATION samples
+        uint32_t cic_integrator1[GAS_CHANNELS];
+        uint32_t cic_integrator2[GAS_CHANNELS];
+        uint32_t cic_comb1[GAS_CHANNELS];
+        uint32_t cic_comb2[GAS_CHANNELS];
+        uint16_t cic_phase = 0;
+        uint8_t cic_warmup = 0;         // outputs left before the comb delays hold real data
+        // Decimated outputs accumulated since the last getGASdata()
+        uint16_t gas_n = 0;
+        uint32_t gas_sum[GAS_CHANNELS];
+        uint64_t gas_sum_sq[GAS_CHANNELS];
+        uint16_t gas_min[GAS_CHANNELS];
+        uint16_t gas_max[GAS_CHANNELS];
 };
\ No newline at end of file
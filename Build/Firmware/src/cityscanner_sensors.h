@@ -0,0 +1,24 @@
+#pragma once
+#include "cityscanner_CONFIG.h"
+
+// Environmental sensors fitted to this hardware variant, fixed at compile time.
+// Every use is a constant condition, so a sensor that is not fitted is never
+// started or read, its driver is dropped by the linker and its columns are left
+// out of the Data record.
+struct SensorSet
+{
+    bool opc;
+    bool temp;
+    bool ir;
+    bool gas;
+    bool noise;
+};
+
+// The Harvard pilot boards have neither the IR nor the noise sensor
+constexpr SensorSet SENSORS = {
+    OPC_ENABLED,
+    TEMP_ENABLED,
+    IR_ENABLED && !HARVARD_PILOT,
+    GAS_ENABLED,
+    NOISE_ENABLED && !HARVARD_PILOT,
+};
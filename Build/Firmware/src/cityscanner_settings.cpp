@@ -0,0 +1,94 @@
+#include "cityscanner_settings.h"
+#include "cityscanner.h"
+
+CitySettings *CitySettings::_instance = nullptr;
+
+static const char *mode_names[] = {"idle", "realtime", "logging", "pwrsave", "test"};
+
+CitySettings::CitySettings() {
+    reset();
+}
+
+uint32_t CitySettings::crc32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    while(length--)
+    {
+        crc ^= *data++;
+        for(int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+// Defaults from cityscanner_config.h, not saved
+void CitySettings::reset()
+{
+    settings.magic = SETTINGS_MAGIC;
+    settings.version = SETTINGS_VERSION;
+    settings.mode = Cityscanner::MODE;
+    settings.sample_rate = SAMPLE_RATE;
+    settings.vitals_rate = VITALS_RATE;
+    settings.records_per_file = RECORDS_PER_FILE;
+    settings.opc_data_version = OPC_DATA_VERSION;
+    settings.autosleep = AUTOSLEEP;
+}
+
+bool CitySettings::load()
+{
+    Settings stored;
+    EEPROM.get(SETTINGS_ADDRESS, stored);
+    if(stored.magic != SETTINGS_MAGIC || stored.version != SETTINGS_VERSION ||
+       stored.crc != crc32((const uint8_t *)&stored, offsetof(Settings, crc)))
+    {
+        Log.info("Settings: none stored or not valid, using the defaults");
+        reset();
+        return false;
+    }
+    settings = stored;
+    Log.info("Settings: " + report());
+    return true;
+}
+
+void CitySettings::save()
+{
+    settings.crc = crc32((const uint8_t *)&settings, offsetof(Settings, crc));
+    EEPROM.put(SETTINGS_ADDRESS, settings);
+}
+
+bool CitySettings::set(String name, String value)
+{
+    long number = value.toInt();
+    if(!name.compareTo("sample_rate") && number >= 1 && number <= 3600)
+        settings.sample_rate = number;
+    else if(!name.compareTo("vitals_rate") && number >= 1 && number <= 65535)
+        settings.vitals_rate = number;
+    else if(!name.compareTo("records") && number >= 1 && number <= 10000)
+        settings.records_per_file = number;
+    else if(!name.compareTo("opc_data") && (!value.compareTo("base") || !value.compareTo("extended")))
+        settings.opc_data_version = value.compareTo("base") ? EXTENDED : BASE;
+    else if(!name.compareTo("autosleep") && (!value.compareTo("on") || !value.compareTo("off")))
+        settings.autosleep = !value.compareTo("on");
+    else if(!name.compareTo("mode"))
+    {
+        uint8_t mode;
+        for(mode = 0; mode < sizeof(mode_names) / sizeof(mode_names[0]); mode++)
+            if(!value.compareTo(mode_names[mode]))
+                break;
+        if(mode == sizeof(mode_names) / sizeof(mode_names[0]))
+            return false;
+        settings.mode = mode;
+    }
+    else
+        return false;
+    save();
+    return true;
+}
+
+String CitySettings::report()
+{
+    return String::format("mode=%s,sample_rate=%u,vitals_rate=%u,records=%u,opc_data=%s,autosleep=%s",
+                          settings.mode < sizeof(mode_names) / sizeof(mode_names[0]) ? mode_names[settings.mode] : "na",
+                          settings.sample_rate, settings.vitals_rate, settings.records_per_file,
+                          settings.opc_data_version == BASE ? "base" : "extended", settings.autosleep ? "on" : "off");
+}
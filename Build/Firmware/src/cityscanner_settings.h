@@ -0,0 +1,57 @@
+#pragma once
+#include "Particle.h"
+#include "cityscanner_CONFIG.h"
+
+#define SETTINGS_ADDRESS 0      // EEPROM offset
+#define SETTINGS_MAGIC 0xC175
+#define SETTINGS_VERSION 1      // bump when the layout of Settings changes, stored settings are then reset
+
+// Deployment parameters that can be changed from the CLI without reflashing
+struct Settings
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t mode;               // IDLE, REALTIME, LOGGING, PWRSAVE, TEST, applied on the next boot
+    uint16_t sample_rate;       // seconds
+    uint16_t vitals_rate;       // seconds
+    uint16_t records_per_file;
+    uint8_t opc_data_version;   // BASE or EXTENDED
+    uint8_t autosleep;
+    uint32_t crc;               // CRC32 of the fields above
+};
+
+class CitySettings {
+    public:
+        static CitySettings &instance() {
+            if(!_instance) {
+                _instance = new CitySettings();
+            }
+            return *_instance;
+        }
+
+        /**
+         * @brief Read the settings from EEPROM, the config.h defaults are used when they are
+         * missing, from another version or corrupted
+         *
+         * @retval true if the stored settings were valid
+         */
+        bool load(void);
+        void save(void);
+        void reset(void);
+
+        /**
+         * @brief Change one setting and save it
+         *
+         * @param name sample_rate, vitals_rate, records, opc_data, mode or autosleep
+         * @retval false if the name or the value is not valid
+         */
+        bool set(String name, String value);
+        String report(void);
+        const Settings &get(void) { return settings; }
+
+    private:
+        CitySettings();
+        static CitySettings* _instance;
+        static uint32_t crc32(const uint8_t *data, size_t length);
+        Settings settings;
+};
@@ -29,9 +29,11 @@ void CitySleep::stop(){
    
     vitals.stop_all();
     sense.stop_all();
-    core.enable3V3(FALSE);
+    core.beginTransaction();
+    CityPower::instance().disableRail(CityPower::RAIL_3V3);
     core.enableOPC(FALSE);
-    core.enable5V(FALSE);
+    CityPower::instance().disableRail(CityPower::RAIL_5V);
+    core.commit();
     //if(Particle.connected())
     //    Particle.publish("WAR","Going into STOP Mode");
     if(Cityscanner::instance().debug_mode){
@@ -52,36 +54,49 @@ void CitySleep::stop(){
         Cityscanner::instance().sendWarning("WOKENUP");
     }
     //Particle.publish("WAR","Waking up from STOP Mode");
-    delay(1s);
-    core.enable3V3(TRUE);
-    locationService.start();
-    vitals.init();
-    sense.startNOISE();
-    sense.startTEMP();
-    sense.startGAS();
+    CityPower &power = CityPower::instance();
+    core.beginTransaction();
+    power.enableRail(CityPower::RAIL_3V3);
+    power.enableRail(CityPower::RAIL_5V);
+    power.enableRail(CityPower::RAIL_GPS);
+    core.commit();
+    power.addStep("GPS", CityPower::RAIL_GPS, [this]() { return locationService.start() == 1; });
+    if(BATT_ENABLED)
+        power.addStep("Battery", CityPower::RAIL_NONE, [this]() { return vitals.startBattery(); });
+    power.addStep("Solar", CityPower::RAIL_3V3, [this]() { return vitals.startSolar(); });
+    power.addStep("Internal temperature", CityPower::RAIL_3V3, [this]() { return vitals.startTempInt(); });
+    if(SENSORS.noise)
+        power.addStep("Noise", CityPower::RAIL_3V3, [this]() { return sense.startNOISE(); });
+    if(SENSORS.temp)
+        power.addStep("Temperature", CityPower::RAIL_3V3, [this]() { return sense.startTEMP(); });
+    if(SENSORS.gas)
+        power.addStep("Gas", CityPower::RAIL_3V3, [this]() { return sense.startGAS(); });
     //init SD card
     //store.init();
-    delay(1s);
-    core.enable5V(TRUE);
-    delay(1s);
-    if(OPC_ENABLED)
-        sense.startOPC();
+    if(SENSORS.opc)
+        power.addStep("OPC", CityPower::RAIL_5V, [this]() { return sense.startOPC(); });
+    power.run();
+    if(SENSORS.gas && !sense.gasSampling())
+        Cityscanner::instance().sendWarning("GAS_NOT_SAMPLING");
 }
 
 void CitySleep::hibernate(uint8_t duration, uint8_t type){
     Log.info("Preparing for HIBERNATION mode");
     delay(100);
+    //location first, it saves the GNSS database to the SD card
+    locationService.stop();
     store.stop();
     SPI.endTransaction();
     SPI.end();
     delay(500);
     //motionService.stop();
-    locationService.stop();
     vitals.stop_all();
     sense.stop_all();
-    core.enable3V3(FALSE);
+    core.beginTransaction();
+    CityPower::instance().disableRail(CityPower::RAIL_3V3);
     core.enableOPC(FALSE);
-    core.enable5V(FALSE);
+    CityPower::instance().disableRail(CityPower::RAIL_5V);
+    core.commit();
     delay(DTIME);
 
     Log.info("Going into HIBERNATION mode");
@@ -115,3 +130,93 @@ void CitySleep::hibernate(uint8_t duration, uint8_t type){
     delay(100);
 
 }
+
+// Called on every routine run. Keeps a short history of battery voltage and solar current and
+// projects the battery voltage ENERGY_HORIZON hours ahead from its trend:
+// NORMAL   full sample rate, all sensors
+// SAVE     projected voltage below ENERGY_SAVE_ENTER above LOW_BATTERY_THRESHOLD: slower sampling, OPC off,
+//          left once the projection is back above ENERGY_SAVE_EXIT
+// CRITICAL battery already below LOW_BATTERY_THRESHOLD: hibernate
+// Turning the OPC off lifts the battery voltage, so the trend restarts from the first reading under
+// the new load and the tier is kept for ENERGY_MIN_DWELL runs, until that trend is long enough.
+uint8_t CitySleep::plan(){
+    float battery_v = vitals.getBatteryVoltage();
+    float solar_ma = vitals.getSolarCurrent();
+    batt_history[history_head] = battery_v;
+    solar_history[history_head] = solar_ma;
+    history_head = (history_head + 1) % ENERGY_HISTORY;
+    if(history_count < ENERGY_HISTORY)
+        history_count++;
+
+    uint8_t tier = energy_tier;
+    if(battery_v < LOW_BATTERY_THRESHOLD)
+        tier = ENERGY_CRITICAL;
+    else if(!ENERGY_PLANNER)
+        tier = ENERGY_NORMAL;
+    else
+    {
+        float projected = battery_v + getBatterySlope() * ENERGY_HORIZON;
+        if(tier_runs < ENERGY_MIN_DWELL)
+            ; // trend too short to leave the current tier
+        else if(projected < LOW_BATTERY_THRESHOLD + ENERGY_SAVE_ENTER)
+            tier = ENERGY_SAVE;
+        else if(projected > LOW_BATTERY_THRESHOLD + ENERGY_SAVE_EXIT)
+            tier = ENERGY_NORMAL;
+        Log.info("Energy plan: %.2fV, projected %.2fV, solar %.1fmA, tier %d", battery_v, projected, solar_ma, tier);
+    }
+
+    if(tier != energy_tier)
+    {
+        energy_tier = tier;
+        tier_runs = 0;
+        history_count = 1;
+    }
+    if(tier_runs < ENERGY_MIN_DWELL)
+        tier_runs++;
+    return energy_tier;
+}
+
+// Least squares slope of the battery history, volt per hour
+float CitySleep::getBatterySlope(){
+    if(history_count < 2)
+        return 0;
+    float sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+    uint8_t index = (history_head + ENERGY_HISTORY - history_count) % ENERGY_HISTORY;
+    for(uint8_t i = 0; i < history_count; i++)
+    {
+        float x = i * ROUTINE_RATE / 3600.0;
+        float y = batt_history[index];
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+        index = (index + 1) % ENERGY_HISTORY;
+    }
+    float den = history_count * sum_xx - sum_x * sum_x;
+    if(den == 0)
+        return 0;
+    return (history_count * sum_xy - sum_x * sum_y) / den;
+}
+
+uint8_t CitySleep::getSampleFactor(){
+    if(energy_tier == ENERGY_SAVE)
+        return ENERGY_SAVE_FACTOR;
+    return 1;
+}
+
+// A battery that is being recharged is checked again sooner
+uint8_t CitySleep::getHibernateHours(){
+    if(!ENERGY_PLANNER || history_count == 0)
+        return 6;
+    float solar_ma = 0;
+    uint8_t index = (history_head + ENERGY_HISTORY - history_count) % ENERGY_HISTORY;
+    for(uint8_t i = 0; i < history_count; i++)
+    {
+        solar_ma += solar_history[index];
+        index = (index + 1) % ENERGY_HISTORY;
+    }
+    solar_ma /= history_count;
+    if(solar_ma > ENERGY_SOLAR_CHARGING)
+        return 1;
+    return 6;
+}
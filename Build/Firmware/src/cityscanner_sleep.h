@@ -4,6 +4,7 @@
 #include "cityscanner_sense.h"
 #include "cityscanner_vitals.h"
 #include "CS_core.h"
+#include "cityscanner_power.h"
 #include "location_service.h"
 #include "motion_service.h"
 
@@ -37,9 +38,26 @@ class CitySleep {
         int init();
         void stop();
         void hibernate(uint8_t duration, uint8_t type);
-        
+
+        enum EnergyTiers
+        {
+            ENERGY_NORMAL,
+            ENERGY_SAVE,
+            ENERGY_CRITICAL
+        };
+        uint8_t energy_tier = ENERGY_NORMAL;
+        uint8_t plan();
+        uint8_t getSampleFactor();
+        uint8_t getHibernateHours();
+
 
     private:
         CitySleep();
         static CitySleep* _instance;
+        float getBatterySlope();
+        float batt_history[ENERGY_HISTORY];     // volt
+        float solar_history[ENERGY_HISTORY];    // mA
+        uint8_t history_head = 0;
+        uint8_t history_count = 0;
+        uint16_t tier_runs = 0;                 // routine runs since boot or the last tier change
 };
\ No newline at end of file
@@ -1,4 +1,7 @@
 #include "cityscanner_store.h"
+#include "cityscanner_trace.h"
+#include "cityscanner_settings.h"
+#include "cityscanner_schema.h"
 
 CityStore *CityStore::_instance = nullptr;
 
@@ -7,7 +10,8 @@ CityStore::CityStore() {}
 int CityStore::init()
 {
     deviceID = System.deviceID();
-    records = RECORDS_PER_FILE;
+    randomSeed(HAL_RNG_GetRandomNumber()); // dump jitter must differ between devices
+    records = CitySettings::instance().get().records_per_file;
     Serial.println("\nInitializing SD card...");
     if (!SD.begin(chipSelect))
     {
@@ -56,17 +60,21 @@ int CityStore::switch_logfile()
     activeFile = SD.open("active.csv", O_WRITE | O_CREAT | O_APPEND);
     if (activeFile)
         Serial.println("active.csv created");    
+    writeHeader();
     cnt = 1;
     return 1;
   }
-  else if (!activeFile)
+  else if (!activeFile && headerCurrent())
   {
     activeFile = SD.open("active.csv", O_WRITE | O_CREAT | O_APPEND);
     if (activeFile)
       Serial.println("active.csv is opened!");
+    writeHeader();
     cnt = 1;
     return 1;
   }
+  else if (!activeFile)
+    Serial.println("active.csv has another layout, starting a new file");
 
   if (activeFile)
   {
@@ -78,7 +86,7 @@ int CityStore::switch_logfile()
   // rename active file and move it to queue folder
   String fileName = String::format("%02d%02d%02d%02d", Time.month(), Time.day(), Time.hour(), Time.minute());
   fileName = "queue/" + fileName;
-  fileName = fileName + ".csv";
+  fileName = fileName + (RECORD_BINARY ? ".bin" : ".csv");
   File newFile = SD.open(fileName, O_WRITE | O_CREAT | O_APPEND);
   if (newFile)
   {
@@ -103,6 +111,7 @@ int CityStore::switch_logfile()
     Serial.println("opening new file failed!");
   else
     Serial.println("File switch successfull : " + fileName);
+  writeHeader();
   cnt = 1;
   return 1;
 }
@@ -111,7 +120,30 @@ void CityStore::logData(int broadcastType, int payloadType, String data)
 {
   //String output = String::format("%d,%s,%d,%s,%s", payloadType, deviceID.c_str(), (int)Time.now(), LocationService::instance().getGPSdata().c_str(), data.c_str());
   String output = String::format("%d,%s,%s,%s,%s", payloadType, deviceID.c_str(), LocationService::instance().getEpochTime().c_str(), LocationService::instance().getGPSdata().c_str(), data.c_str());
-  writeData(output);
+  if (RECORD_BINARY)
+  {
+    size_t size = CitySchema::instance().maxLength(payloadType);
+    if (size > record_buffer_size)
+    {
+      uint8_t *buffer = (uint8_t *)realloc(record_buffer, size);
+      if (buffer)
+      {
+        record_buffer = buffer;
+        record_buffer_size = size;
+      }
+    }
+    size_t length = record_buffer ? CitySchema::instance().encode(payloadType, output, record_buffer, record_buffer_size) : 0;
+    if (length)
+      writeData(record_buffer, length);
+    else
+      TRACE(TRACE_SCHEMA_MISMATCH, payloadType, output.length());
+  }
+  else
+  {
+    if (RECORD_HEADER && !CitySchema::instance().matches(payloadType, output))
+      TRACE(TRACE_SCHEMA_MISMATCH, payloadType, output.length());
+    writeData(output);
+  }
 
   switch (broadcastType)
   {
@@ -126,14 +158,72 @@ void CityStore::logData(int broadcastType, int payloadType, String data)
 
 void CityStore::writeData(String data)
 {
-  Serial.print("Record to file:"); Serial.println(data);
+  uint32_t start = System.ticks();
   activeFile.println(data);
   activeFile.flush();
+  recordWritten(System.ticks() - start, data.length());
+}
+
+// Binary record from CitySchema::encode()
+void CityStore::writeData(const uint8_t *record, size_t length)
+{
+  uint32_t start = System.ticks();
+  activeFile.write(record, length);
+  activeFile.flush();
+  recordWritten(System.ticks() - start, length);
+}
+
+// Layout of every record type at the top of a new data file, so each file can be
+// decoded on its own (see tools/record_decode.py)
+String CityStore::header()
+{
+  String header = "";
+  for (uint8_t type = Data; type <= Stats; type++)
+    header += CitySchema::instance().header(type) + "\r\n";
+  header += RECORD_BINARY ? "#records,binary\r\n" : "#records,csv\r\n";
+  return header;
+}
+
+// True when active.csv is empty or starts with the header of this firmware, a file left
+// by a firmware with another layout must not get records appended under its old header
+bool CityStore::headerCurrent()
+{
+  if (!RECORD_HEADER && !RECORD_BINARY)
+    return true;
+  File file = SD.open("active.csv", O_READ);
+  if (!file)
+    return true;
+  String expected = header();
+  bool current = file.size() == 0;
+  if (!current && file.size() >= expected.length())
+  {
+    current = true;
+    for (unsigned int i = 0; current && i < expected.length(); i++)
+      current = file.read() == expected.charAt(i);
+  }
+  file.close();
+  return current;
+}
+
+void CityStore::writeHeader()
+{
+  if ((!RECORD_HEADER && !RECORD_BINARY) || !activeFile || activeFile.size() > 0)
+    return;
+  activeFile.print(header());
+  activeFile.flush();
+}
+
+void CityStore::recordWritten(uint32_t ticks, size_t length)
+{
+  write_count++;
+  write_ticks += ticks;
+  if (ticks > write_max_ticks)
+    write_max_ticks = ticks;
   cnt += 1;
-  Serial.print("N. records written to file : "); Serial.println(cnt);
+  TRACE(TRACE_RECORD_WRITTEN, cnt, length);
   if (cnt % records == 0) //keep
   {
-    Serial.println("SWITCHING FILE"); 
+    TRACE(TRACE_FILE_SWITCH, cnt, 0);
     switch_logfile();
     cnt = 1;
   }
@@ -142,6 +232,7 @@ void CityStore::writeData(String data)
 // Numbers of files in the queue folder to be dumped via tcp or ALL_FILES
 bool CityStore::dumpData(int files_to_dump)
 {
+    files_dumped = 0;
     if (files_to_dump == ALL_FILES) {
         files_to_dump = countFilesInQueue();
     }
@@ -169,6 +260,8 @@ bool CityStore::dumpData(int files_to_dump)
             file = queueFolder.openNextFile(O_READ);
             if (!file){
                 Serial.println("File retrieve from queue failed (no file to broadcast)!");
+                client.stop();
+                queueFolder.close();
                 return false;
             }
             String filename = "queue/" + String(file.name());
@@ -179,21 +272,41 @@ bool CityStore::dumpData(int files_to_dump)
             Serial.println(file_size);
             if (file.size() > 0)
             {
-                char *body;
-                body = (char *)malloc(file_size);
-                file.read(body, file_size);
+                // streamed in chunks, allocating whole files fragments the heap
+                uint8_t chunk[DUMP_CHUNK_SIZE];
+                int n, body_resp = 0;
+                unsigned long upload_start = millis();
                 if(TCP_GHOSTWRITE)
+                    Serial.println("Sending the following data over TCP");
+                while ((n = file.read(chunk, sizeof(chunk))) > 0)
                 {
-                    Serial.println("Sending the following data over TCP"); Serial.println(body);
+                    if(TCP_GHOSTWRITE)
+                    {
+                        Serial.write(chunk, n);
+                        continue;
+                    }
+                    int sent = sendChunk(chunk, n);
+                    body_resp += sent;
+                    if (sent < n)
+                        break; // the rest of the file would land in the wrong place
                 }
                 if(!TCP_GHOSTWRITE)
                 {
-                // write TCP body
-                int body_resp = client.write(reinterpret_cast<const uint8_t *>(body), file_size);
-                Serial.print("TCP body write result: "); Serial.println(body_resp);
+                TRACE(TRACE_DUMP_FILE, file_size, body_resp);
                 client.flush();
+                if (body_resp > 0)
+                  upload_bytes += body_resp;
+                upload_ms += millis() - upload_start;
+                if (body_resp < file_size)
+                {
+                    // endpoint busy or gone, the file stays in the queue for the retry
+                    Serial.println("Dump interrupted, file kept in queue");
+                    file.close();
+                    client.stop();
+                    queueFolder.close();
+                    return false;
+                }
                 }
-                free(body);
             }
             file.close(); // close to open again later to read from the beginning of file;
             // move file from queue to done folder
@@ -201,8 +314,8 @@ bool CityStore::dumpData(int files_to_dump)
             File newFile = SD.open(newFileName, O_WRITE | O_CREAT | O_APPEND);
             if (newFile)
             {
-                size_t n;
-                uint8_t buf[1000];
+                int n;
+                uint8_t buf[DUMP_CHUNK_SIZE];
                 file = SD.open(filename, O_READ);
                 while ((n = file.read(buf, sizeof(buf))) > 0)
                 {
@@ -212,6 +325,7 @@ bool CityStore::dumpData(int files_to_dump)
                 newFile.close();
                 file.close();
                 SD.remove(filename);
+                files_dumped++;
             }
             else{
                 Serial.println("File could not be moved to done folder!");
@@ -219,14 +333,38 @@ bool CityStore::dumpData(int files_to_dump)
             }
         }
         client.stop();
+        queueFolder.close();
         return true;
     }
     else{
         Serial.println("The connection cannot be established");
+        queueFolder.close();
         return false;
     }
 }
 
+// Writes the whole chunk, TCPClient::write() can take only part of it when the send buffer is full.
+// Returns the bytes written, less than length when the endpoint stops taking data for DUMP_WRITE_TIMEOUT
+int CityStore::sendChunk(const uint8_t *chunk, int length)
+{
+    int sent = 0;
+    unsigned long last_progress = millis();
+    while (sent < length && client.connected())
+    {
+        int written = client.write(chunk + sent, length - sent);
+        if (written > 0)
+        {
+            sent += written;
+            last_progress = millis();
+        }
+        else if (millis() - last_progress > DUMP_WRITE_TIMEOUT)
+            break;
+        else
+            delay(10);
+    }
+    return sent;
+}
+
 int CityStore::countFilesInQueue()
 {
   File queueFolder;
@@ -247,6 +385,44 @@ int CityStore::countFilesInQueue()
   return k;
 }
 
+// Size of the files waiting in the queue folder, their number in files
+uint32_t CityStore::queuedBytes(int *files)
+{
+  uint32_t bytes = 0;
+  *files = 0;
+  File queueFolder = SD.open("/queue", O_READ);
+  if (!queueFolder)
+    return 0;
+  File file = queueFolder.openNextFile(O_READ);
+  while (file) {
+    (*files)++;
+    bytes += file.size();
+    file.close();
+    file = queueFolder.openNextFile(O_READ);
+  }
+  queueFolder.close();
+  return bytes;
+}
+
+// sd_write_avg_us,sd_write_max_us,queued_files,queued_bytes,upload_Bps since the previous call
+// The write and upload counters restart when reset_counters is set, once per Stats record
+String CityStore::getStats(bool reset_counters)
+{
+  int files;
+  uint32_t bytes = queuedBytes(&files);
+  uint32_t tpu = System.ticksPerMicrosecond();
+  String stats = String::format("%lu,%lu,%d,%lu,%s",
+                                write_count ? write_ticks / write_count / tpu : 0, write_max_ticks / tpu,
+                                files, bytes,
+                                upload_ms ? String((unsigned long)(upload_bytes * 1000ULL / upload_ms)).c_str() : "na");
+  if (reset_counters)
+  {
+    write_count = write_ticks = write_max_ticks = 0;
+    upload_bytes = upload_ms = 0;
+  }
+  return stats;
+}
+
 bool CityStore::deleteAll(bool removeDirs)
 {
   delFiles("/queue");
@@ -319,3 +495,62 @@ void CityStore::reInit()
   Serial.println("Sd re-initialized");
   switch_logfile();
 }
+
+// Slot of this device among slots, stable across dumps
+static uint16_t deviceSlot(const String &device_id, uint16_t slots)
+{
+  uint32_t hash = 2166136261UL; // FNV-1a
+  for (unsigned int i = 0; i < device_id.length(); i++)
+    hash = (hash ^ device_id.charAt(i)) * 16777619UL;
+  return hash % slots;
+}
+
+uint32_t CityStore::scheduleDump(int files_to_dump, uint16_t slot, uint16_t slots)
+{
+  if (slots == 0)
+    dump_delay = random(DUMP_JITTER * 1000 + 1);
+  else
+  {
+    if (slot >= slots)
+      slot = deviceSlot(deviceID, slots);
+    dump_delay = (uint32_t)slot * DUMP_SLOT_LENGTH * 1000 + random(DUMP_SLOT_LENGTH * 1000);
+  }
+  dump_files = files_to_dump;
+  dump_attempt = 0;
+  dump_start = millis();
+  dump_pending = true;
+  TRACE(TRACE_DUMP_SCHEDULED, dump_delay / 1000, 0);
+  Log.info("Dump scheduled in %lu s", dump_delay / 1000);
+  return dump_delay / 1000;
+}
+
+// Runs the scheduled dump when it is due, called from the main loop
+void CityStore::loop()
+{
+  if (!dump_pending || millis() - dump_start < dump_delay)
+    return;
+
+  bool done = dumpData(dump_files);
+  if (dump_files != ALL_FILES)
+    dump_files -= files_dumped;
+  if (done || dump_files == 0)
+  {
+    dump_pending = false;
+    if (Particle.connected())
+      Particle.publish("DUMP", dump_files == ALL_FILES ? "ended_dumping_all_data" : "ended_dumping_files");
+  }
+  else if (++dump_attempt > DUMP_RETRIES)
+  {
+    dump_pending = false;
+    if (Particle.connected())
+      Particle.publish("DUMP", "failed_dumping_data");
+  }
+  else
+  {
+    // exponential backoff, randomized so the retries of a fleet spread out
+    uint32_t backoff = min(DUMP_BACKOFF_BASE << (dump_attempt - 1), DUMP_BACKOFF_MAX) * 1000UL;
+    dump_delay = backoff / 2 + random(backoff / 2 + 1);
+    dump_start = millis();
+    TRACE(TRACE_DUMP_SCHEDULED, dump_delay / 1000, dump_attempt);
+  }
+}
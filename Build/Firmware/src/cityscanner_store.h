@@ -4,6 +4,8 @@
 #include "SPI.h"
 #include "location_service.h"
 #define ALL_FILES -1
+#define DUMP_CHUNK_SIZE 512 //bytes read from the SD card at a time when dumping
+#define DUMP_WRITE_TIMEOUT 5000 //ms a chunk may take to be taken by the TCP client before the file is aborted
 
 #define BROADCAST_NONE 0
 #define BROADCAST_IMMEDIATE 1
@@ -12,7 +14,8 @@
 enum payloadType {
   Data,
   Vitals,
-  Warning
+  Warning,
+  Stats
 };
 
 class CityStore {
@@ -36,8 +39,20 @@ class CityStore {
         int switch_logfile();
         void logData(int broadcastType, int payloadType, String data);
         void writeData(String data);
+        void writeData(const uint8_t *record, size_t length);
         bool dumpData(int files_to_dump);
+
+        /**
+         * @brief Dump files_to_dump files in the slot given by the server, or at a random time within
+         * DUMP_JITTER when slots is 0, so a fleet asked to dump at once does not flood the endpoint
+         *
+         * @param slot slot of this device, from 0 to slots - 1, derived from the device ID if out of range
+         * @retval seconds until the dump starts
+         */
+        uint32_t scheduleDump(int files_to_dump, uint16_t slot, uint16_t slots);
+        void loop(void);
         int countFilesInQueue();
+        String getStats(bool reset_counters);
         String deviceID = "na";
     
     private:
@@ -50,5 +65,27 @@ class CityStore {
         
         bool deleteAll(bool removeDirs);
         void delFiles(const char *folder_name);
+        uint32_t queuedBytes(int *files);
+        String header(void);
+        bool headerCurrent(void);
+        void writeHeader(void);
+        void recordWritten(uint32_t ticks, size_t length);
+        int sendChunk(const uint8_t *chunk, int length);
+        // Since the last getStats(true)
+        uint32_t write_count = 0;
+        uint32_t write_ticks = 0;
+        uint32_t write_max_ticks = 0;
+        uint32_t upload_bytes = 0;
+        uint32_t upload_ms = 0;
+        // Binary record, grown to the largest layout seen
+        uint8_t *record_buffer = NULL;
+        size_t record_buffer_size = 0;
+        // Scheduled dump, retried with exponential backoff
+        bool dump_pending = false;
+        int dump_files = ALL_FILES;
+        int files_dumped = 0;       // by the last dumpData()
+        uint8_t dump_attempt = 0;
+        unsigned long dump_start = 0;
+        uint32_t dump_delay = 0;    // ms after dump_start
        
 };
\ No newline at end of file
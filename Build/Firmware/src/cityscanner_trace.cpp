@@ -0,0 +1,94 @@
+#include "cityscanner_trace.h"
+
+CityTrace *CityTrace::_instance = nullptr;
+
+CityTrace::CityTrace() {
+    memset(ring, 0, sizeof(ring));
+}
+
+void CityTrace::log(uint16_t id, int32_t arg0, int32_t arg1)
+{
+    ATOMIC_BLOCK() {
+        TraceEvent &event = ring[head];
+        event.timestamp = millis();
+        event.id = id;
+        event.sequence = sequence++;
+        event.arg0 = arg0;
+        event.arg1 = arg1;
+        head = (head + 1) % TRACE_RING_SIZE;
+        if(stored < TRACE_RING_SIZE)
+            stored++;
+    }
+}
+
+void CityTrace::clear()
+{
+    ATOMIC_BLOCK() {
+        head = 0;
+        stored = 0;
+    }
+}
+
+// Copies the newest count events, oldest first
+uint16_t CityTrace::copy(TraceEvent *events, uint16_t count)
+{
+    ATOMIC_BLOCK() {
+        if(count > stored)
+            count = stored;
+        uint16_t start = (head + TRACE_RING_SIZE - count) % TRACE_RING_SIZE;
+        for(uint16_t i = 0; i < count; i++)
+            events[i] = ring[(start + i) % TRACE_RING_SIZE];
+    }
+    return count;
+}
+
+static String toHex(const TraceEvent &event)
+{
+    const uint8_t *bytes = (const uint8_t *)&event;
+    char hex[sizeof(TraceEvent) * 2 + 1];
+    for(size_t i = 0; i < sizeof(TraceEvent); i++)
+        snprintf(&hex[i * 2], 3, "%02x", bytes[i]);
+    return String(hex);
+}
+
+// TRACE,<events> then one line per event and TRACE,END, decoded by tools/trace_decode.py
+int CityTrace::dump()
+{
+    TraceEvent event;
+    uint16_t count = stored;
+    Serial.printlnf("TRACE,%u", count);
+    // one event at a time, the ring keeps filling while Serial blocks
+    for(uint16_t i = count; i > 0; i--)
+    {
+        bool valid;
+        ATOMIC_BLOCK() {
+            valid = i <= stored;
+            if(valid)
+                event = ring[(head + TRACE_RING_SIZE - i) % TRACE_RING_SIZE];
+        }
+        if(valid)
+            Serial.println(toHex(event));
+    }
+    Serial.println("TRACE,END");
+    return count;
+}
+
+String CityTrace::last(size_t max_length)
+{
+    uint16_t count = max_length / (sizeof(TraceEvent) * 2 + 1);
+    if(count > TRACE_RING_SIZE)
+        count = TRACE_RING_SIZE;
+    TraceEvent *events = new TraceEvent[count];
+    if(events == nullptr)
+        return "na";
+    count = copy(events, count);
+    String response = "";
+    for(uint16_t i = 0; i < count; i++)
+    {
+        if(i)
+            response += " ";
+        response += toHex(events[i]);
+    }
+    delete[] events;
+    return response.length() ? response : "na";
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "Particle.h"
+#include "cityscanner_CONFIG.h"
+
+#define TRACE_RING_SIZE 256 //events, 16 bytes each
+
+// Event ids, keep in sync with tools/trace_decode.py
+enum TraceEvents
+{
+    TRACE_NONE,
+    TRACE_RECORD_WRITTEN,   // records in the active file, record length
+    TRACE_FILE_SWITCH,      // records in the closed file
+    TRACE_DUMP_FILE,        // file size, TCP write result
+    TRACE_INACTIVE,         // seconds since the last motion
+    TRACE_ENERGY_TIER,      // new tier
+    TRACE_SCHEMA_MISMATCH,  // payload type, record length
+    TRACE_DUMP_SCHEDULED,   // seconds until the dump, retry number
+    TRACE_EVENT_COUNT
+};
+
+// 16 bytes, little endian on the wire: millis, id, sequence, arg0, arg1
+struct TraceEvent
+{
+    uint32_t timestamp;
+    uint16_t id;
+    uint16_t sequence;
+    int32_t arg0;
+    int32_t arg1;
+};
+
+class CityTrace {
+    public:
+        static CityTrace &instance() {
+            if(!_instance) {
+                _instance = new CityTrace();
+            }
+            return *_instance;
+        }
+
+        /**
+         * @brief Store an event in the ring, safe from interrupts and threads
+         */
+        void log(uint16_t id, int32_t arg0, int32_t arg1);
+
+        /**
+         * @brief Write every event in the ring to Serial, one hex line per event
+         */
+        int dump(void);
+
+        /**
+         * @brief Newest events as hex, at most max_length characters
+         */
+        String last(size_t max_length);
+        void clear(void);
+
+    private:
+        CityTrace();
+        static CityTrace* _instance;
+        uint16_t copy(TraceEvent *events, uint16_t count);
+        TraceEvent ring[TRACE_RING_SIZE];
+        uint16_t head = 0;          // next slot to write
+        uint16_t stored = 0;        // events in the ring
+        uint16_t sequence = 0;      // incremented on every event, gaps in a dump show overwritten events
+};
+
+#if TRACE_ENABLED
+#define TRACE(id, arg0, arg1) CityTrace::instance().log(id, arg0, arg1)
+#else
+#define TRACE(id, arg0, arg1)
+#endif
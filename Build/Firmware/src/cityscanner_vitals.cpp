@@ -3,6 +3,9 @@
 #include "HTS221.h"
 #include "ISL28022.h"
 #include "CS_core.h"
+#include "I2C_trace.h"
+#include "core_hal.h"
+#include <malloc.h>
 
 CityVitals *CityVitals::_instance = nullptr;
 BQ27200_I2C batt = BQ27200_I2C(0);
@@ -100,7 +103,11 @@ String CityVitals::getChargingStatus(){
     String charge_status = "0";
     if (SOLAR_started)
     {
-        if (solar.getBusVoltage_V() > 0)
+        float bus_voltage = 0;
+        WITH_LOCK(Wire) {
+            bus_voltage = solar.getBusVoltage_V();
+        }
+        if (bus_voltage > 0)
         {
             charge_status = String::format("%u", 1);
         }
@@ -114,11 +121,15 @@ String CityVitals::getChargingStatus(){
             charge_status.concat(0);
         }
     }
+    else
+        charge_status = "na,na";
     return charge_status;
 }
 
 bool CityVitals::startSolar(){
-    solar.begin(0x45, PV_SENSING);
+    WITH_LOCK(Wire) {
+        solar.begin(0x45, PV_SENSING);
+    }
     SOLAR_started = true;
     return 1;
 }
@@ -130,16 +141,33 @@ bool CityVitals::stopSolar(){
 
 String CityVitals::getSolarData(){
     if(SOLAR_started)
-    return String::format("%.2f",solar.getBusVoltage_V()) + "," + String::format("%.1f",solar.getCurrent_mA());
-    else
+    {
+        WITH_LOCK(Wire) {
+            return String::format("%.2f",solar.getBusVoltage_V()) + "," + String::format("%.1f",solar.getCurrent_mA());
+        }
+    }
     return "na,na";
 }
 
+// mA, 0 when the solar sensor is not started
+float CityVitals::getSolarCurrent(){
+    if(SOLAR_started)
+    {
+        WITH_LOCK(Wire) {
+            return solar.getCurrent_mA();
+        }
+    }
+    return 0;
+}
+
 bool CityVitals::startTempInt(){
-    
-    errorDecoder(shtc3.begin());
-    TEMPint_started = true;
-    return 1;
+    SHTC3_Status_TypeDef status = SHTC3_Status_Error;
+    WITH_LOCK(Wire) {
+        status = shtc3.begin();
+    }
+    errorDecoder(status);
+    TEMPint_started = (status == SHTC3_Status_Nominal);
+    return TEMPint_started;
 }
 
 bool CityVitals::stopTempInt(){
@@ -151,7 +179,9 @@ String CityVitals::getTempIntData(){
     if(TEMPint_started)
     {
         //return String::format("%.1f", temp_internal.readTemperature()) + "," + String::format("%.1f", temp_internal.readHumidity());
-        SHTC3_Status_TypeDef result = shtc3.update();
+        WITH_LOCK(Wire) {
+            shtc3.update();
+        }
         return String::format("%.2f,%.2f", shtc3.toDegC(), shtc3.toPercent());
     }
     else
@@ -180,3 +210,27 @@ String CityVitals::getSignalStrenght(){
     
 
 }
+
+// Per address I2C counters since the previous vitals record
+String CityVitals::getI2Cdata(){
+    if(I2C_TRACE)
+        return I2CTrace::instance().report(true);
+    else
+        return "na";
+}
+
+// heap_used,heap_peak,heap_free,largest_free_block,free_chunks (bytes, count)
+// From the system allocator, the same figures System.freeMemory() reads: heap_peak is its
+// high-water mark since boot and the largest block is found without allocating.
+// A largest block far below the free memory with many free chunks means the heap is fragmented
+String CityVitals::getHeapData(){
+    if(!HEAP_MONITOR)
+        return "na,na,na,na,na";
+    runtime_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.size = sizeof(info);
+    HAL_Core_Runtime_Info(&info, NULL);
+    struct mallinfo heap = mallinfo();
+    return String::format("%lu,%lu,%lu,%lu,%u", info.total_heap - info.freeheap, info.max_used_heap, info.freeheap,
+                          info.largest_free_block_heap, heap.ordblks);
+}
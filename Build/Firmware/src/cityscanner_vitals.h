@@ -33,6 +33,7 @@ class CityVitals {
         bool stopSolar(void);
         bool SOLAR_started = false;
         String getSolarData(void);
+        float getSolarCurrent(void);
         
         bool startTempInt(void);
         bool stopTempInt(void);
@@ -41,6 +42,8 @@ class CityVitals {
         void errorDecoder(SHTC3_Status_TypeDef message);                             // The errorDecoder function prints "SHTC3_Status_TypeDef" resultsin a human-friendly way
 
         String getSignalStrenght();
+        String getI2Cdata(void);
+        String getHeapData(void);
 
     private:
         CityVitals();
@@ -1,12 +1,38 @@
 #include "location_service.h"
 #include "TinyGPS++.h"
 #include "AssetTrackerRK.h"
+#include "UbloxGPS.h"
 #include "CS_core.h"
+#include "cityscanner_power.h"
 #include "TimeLib.h"
 #include "LegacyAdapter.h"
+#include "motion_service.h"
+#include "SD.h"
+
+#define EARTH_RADIUS 6371000.0 //meters
+#define GRAVITY 9.81
+#define DR_MAX_SPEED 40.0 //m/s, clamps the integrated speed
+#define WARM_START_MAGIC 0x57524D53
+#define DBD_MAX_PAYLOAD 180 //bytes, largest MGA-DBD payload
+#define DBD_MAX_MESSAGE (DBD_MAX_PAYLOAD + 8) //header, class, id, length and checksum around the payload
+#define DBD_PACKET_DELAY 2 //ms between restored messages
+#define DBD_TEMP_FILE "gnss.new" //database being saved, GNSS_DBD_FILE is replaced once it is complete
 
 LocationService *LocationService::_instance = nullptr;
 AssetTracker gps;
+Ublox ublox;
+UbloxAssistNow assistNow;
+File assistFile;
+File dbdFile;
+
+// Last GNSS fix, kept in retained RAM so it survives STOP and HIBERNATE
+struct WarmStart {
+    uint32_t magic;
+    double lat;
+    double lon;
+    float alt;
+};
+retained WarmStart warm_start;
 
 tmElements_t gpstime;
 LocationService::LocationService() {
@@ -15,11 +41,18 @@ LocationService::LocationService() {
 int LocationService::start()
 {
     if(!location_started){
-    CS_core::instance().enableGPS(1);
+    CityPower::instance().enableRail(CityPower::RAIL_GPS);
     CS_core::instance().activateGPS(1);
     gps.withI2C();
+    gps.getTinyGPSPlus()->setFilteredMode(GPS_NMEA_FILTER);
     gps.startThreadedMode();
+    ublox.setup();
     location_started = true;
+    setProfile(GPS_PROFILE_MOVING);
+    dbd_time = millis();
+    if(GNSS_WARM_START)
+        restoreWarmStart();
+    startOfflineAssist();
     }
     return 1;
 }
@@ -28,23 +61,375 @@ int LocationService::stop()
 {
     if(location_started)
     {
+    if(assistFile)
+        assistFile.close();
+    if(dbd_state != DBD_IDLE)
+    {
+        // an unfinished save leaves GNSS_DBD_FILE as it was
+        dbdFile.close();
+        if(dbd_state != DBD_RESTORING)
+            SD.remove(DBD_TEMP_FILE);
+        dbd_state = DBD_IDLE;
+    }
+    setProfile(GPS_PROFILE_OFF);
     CS_core::instance().activateGPS(0);
-    CS_core::instance().enableGPS(0);
+    CityPower::instance().disableRail(CityPower::RAIL_GPS);
+    location_started = false;
+    fix_type = FIX_NONE;
+    position = "na,na";
     }
     return 1;
 }
 
-String LocationService::getGPSdata()
+void LocationService::loop()
 {
-    if(location_started)
+    if(!location_started)
+        return;
+    ublox.loop();
+    assistNow.loop();
+    if(GNSS_WARM_START)
+        runWarmStart();
+    if(GPS_PROFILES)
+    {
+        if(MotionService::getInactivityCounter() >= GPS_PARKED_TIME)
+            setProfile(GPS_PROFILE_PARKED);
+        else
+            setProfile(GPS_PROFILE_MOVING);
+    }
+    runProfile();
+}
+
+// MOVING: 1 Hz continuous tracking
+// PARKED: cyclic tracking, one fix every GPS_PARKED_UPDATE seconds
+// OFF:    GNSS engine stopped (STOP mode / hibernate)
+// The profile is applied by runProfile() from loop(), gps_profile changes once every
+// message of it has been acknowledged. OFF is applied at once, the rail goes off next.
+int LocationService::setProfile(uint8_t profile)
+{
+    if(profile > GPS_PROFILE_PARKED)
+        return 0;
+    profile_target = profile;
+    if(profile == GPS_PROFILE_OFF)
+    {
+        if(gps_profile != GPS_PROFILE_OFF)
+        {
+            ublox.stopGNSS();
+            Log.info("GPS profile: off");
+        }
+        gps_profile = GPS_PROFILE_OFF;
+        profile_step = 0;
+        profile_busy = false;
+        return 1;
+    }
+    runProfile();
+    return 1;
+}
+
+// Sends the next CFG message of the target profile once the previous one has been
+// acknowledged. A NAK or a timeout restarts the profile after GPS_PROFILE_RETRY.
+void LocationService::runProfile()
+{
+    if(profile_busy || profile_target == GPS_PROFILE_OFF)
+        return;
+    if(profile_step == 0)
+    {
+        if(profile_target == gps_profile)
+            return;
+        if(profile_failed && millis() - profile_fail_time < GPS_PROFILE_RETRY * 1000UL)
+            return;
+        profile_failed = false;
+        profile_applying = profile_target;
+        if(gps_profile == GPS_PROFILE_OFF)
+            ublox.startGNSS();      // CFG-RST is not acknowledged
+    }
+    else if(profile_target != profile_applying)
+    {
+        profile_step = 0;           // the target changed between two messages
+        return;
+    }
+
+    auto ack = [this](UbloxCommandBase *, UbloxMessageHandler::Reason reason) { profileAck((uint8_t)reason); };
+    profile_busy = true;
+    if(profile_applying == GPS_PROFILE_MOVING)
     {
-    String gpsdata;
-    gpsdata = String(gps.readLatDeg()) + "," + String(gps.readLonDeg());
-    return gpsdata;
+        if(profile_step == 0)
+            ublox.setPowerMode(Ublox::PowerMode::CONTINUOUS, ack);
+        else
+            ublox.setMeasurementRate(1000, 1, ack);
     }
+    else
+    {
+        if(profile_step == 0)
+            ublox.setPowerSaveConfig(GPS_PARKED_UPDATE * 1000UL, GPS_PARKED_UPDATE * 1000UL, true, ack);
+        else
+            ublox.setPowerMode(Ublox::PowerMode::POWER_SAVE, ack);
+    }
+}
+
+void LocationService::profileAck(uint8_t reason)
+{
+    if(reason != (uint8_t)UbloxMessageHandler::Reason::ACK && reason != (uint8_t)UbloxMessageHandler::Reason::NACK &&
+       reason != (uint8_t)UbloxMessageHandler::Reason::TIMEOUT)
+        return;
+    profile_busy = false;
+    if(profile_target == GPS_PROFILE_OFF)
+        return;     // stopped while waiting
+    if(reason != (uint8_t)UbloxMessageHandler::Reason::ACK)
+    {
+        Log.info("GPS profile config failed: %d, retrying", reason);
+        profile_step = 0;
+        profile_failed = true;
+        profile_fail_time = millis();
+        return;
+    }
+    if(++profile_step < 2)
+        return;
+    profile_step = 0;
+    gps_profile = profile_applying;
+    Log.info(gps_profile == GPS_PROFILE_MOVING ? "GPS profile: moving" : "GPS profile: parked");
+}
+
+// Takes the position and the fix type together, once per record cycle, so every record
+// written until the next update carries the fix type of its own latitude and longitude
+void LocationService::updatePosition()
+{
+    if(!location_started)
+        return;
+    updateDeadReckoning();
+    if(fix_type == FIX_DEAD_RECKONING)
+        position = String(dr_lat, 6) + "," + String(dr_lon, 6);
+    else
+        position = String(gps.readLatDeg()) + "," + String(gps.readLonDeg());
+}
+
+String LocationService::getGPSdata()
+{
+    if(location_started)
+    return position;
     else 
     return "na,na";
 }
+
+// Polls the receiver navigation database (ephemeris, almanac, ...) so the next start() can hot
+// start instead of cold starting. Called from loop() every GNSS_DBD_SAVE_INTERVAL while there is
+// a fix: the MGA-DBD messages go to DBD_TEMP_FILE as ublox.loop() delivers them and replace
+// GNSS_DBD_FILE once the receiver goes quiet, so stop() never waits and never leaves half a database.
+void LocationService::saveWarmStart()
+{
+    dbdFile = SD.open(DBD_TEMP_FILE, O_WRITE | O_CREAT | O_TRUNC);
+    if(!dbdFile)
+    {
+        Log.info("GNSS database save failed");
+        return;
+    }
+
+    dbd_state = DBD_SAVING;
+    dbd_messages = 0;
+    ublox.pollNavigationDatabase([this](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+        if(dbd_state != DBD_SAVING)
+            return;     // poll of a save aborted by stop()
+        if(reason == UbloxMessageHandler::Reason::DATA)
+        {
+            dbdFile.write(cmd->getBuffer(), cmd->getSendLength());
+            dbd_messages++;
+        }
+        else
+            dbd_state = DBD_SAVED;
+    });
+}
+
+// Time first, then position, then the navigation database, as recommended for u-blox aiding.
+// The database is sent by runWarmStart(), one message per loop() at most every DBD_PACKET_DELAY.
+void LocationService::restoreWarmStart()
+{
+    if(Time.isValid())
+        ublox.sendTimeAiding(Time.now(), 2);
+    if(warm_start.magic == WARM_START_MAGIC)
+        ublox.sendPositionAiding(warm_start.lat, warm_start.lon, warm_start.alt, GNSS_WARM_POS_ACC);
+
+    dbdFile = SD.open(GNSS_DBD_FILE, O_READ);
+    if(!dbdFile)
+        return;
+    dbd_state = DBD_RESTORING;
+    dbd_messages = 0;
+    dbd_time = millis();
+}
+
+// Next step of the database restore or save, called from loop()
+void LocationService::runWarmStart()
+{
+    switch(dbd_state)
+    {
+    case DBD_IDLE:
+        if(fix_type == FIX_GNSS && millis() - dbd_time >= GNSS_DBD_SAVE_INTERVAL * 1000UL)
+        {
+            dbd_time = millis();
+            saveWarmStart();
+        }
+        break;
+
+    case DBD_RESTORING:
+        if(millis() - dbd_time >= DBD_PACKET_DELAY)
+        {
+            dbd_time = millis();
+            if(!restoreMessage())
+            {
+                dbdFile.close();
+                dbd_state = DBD_IDLE;
+                Log.info("GNSS database restored: %u messages", dbd_messages);
+            }
+        }
+        break;
+
+    case DBD_SAVED:
+    {
+        dbdFile.close();
+        dbd_state = DBD_IDLE;
+        if(dbd_messages == 0)
+        {
+            SD.remove(DBD_TEMP_FILE);   // no fix yet, keep the previous database
+            break;
+        }
+        // moved like the dumped files, the SD library has no rename
+        File temp = SD.open(DBD_TEMP_FILE, O_READ);
+        if(!temp)
+            break;
+        File dbd = SD.open(GNSS_DBD_FILE, O_WRITE | O_CREAT | O_TRUNC);
+        if(dbd)
+        {
+            uint8_t buf[DBD_MAX_MESSAGE];
+            int n;
+            while((n = temp.read(buf, sizeof(buf))) > 0)
+                dbd.write(buf, n);
+            dbd.close();
+            Log.info("GNSS database saved: %u messages", dbd_messages);
+        }
+        temp.close();
+        SD.remove(DBD_TEMP_FILE);
+        break;
+    }
+
+    default:
+        break;     // DBD_SAVING, the poll callback moves on to DBD_SAVED
+    }
+}
+
+// Sends the next MGA-DBD message of the database file, false at its end
+bool LocationService::restoreMessage()
+{
+    uint8_t msg[DBD_MAX_MESSAGE];
+    while(dbdFile.read(msg, 6) == 6)
+    {
+        size_t len = 8 + (msg[4] | (msg[5] << 8));
+        if(msg[0] != 0xB5 || msg[1] != 0x62)
+            return false;
+        // A message larger than expected is skipped, the next one is still restored
+        if(len > sizeof(msg))
+        {
+            if(!dbdFile.seek(dbdFile.position() + len - 6))
+                return false;
+            continue;
+        }
+        if(dbdFile.read(&msg[6], len - 6) != (int)(len - 6))
+            return false;
+        gps.sendCommand(msg, len);
+        dbd_messages++;
+        return true;
+    }
+    return false;
+}
+
+// Streams the AssistNow Offline/Autonomous file staged on the SD card to the receiver, so a
+// fleet can prefetch aiding data once a week instead of downloading it over cellular.
+// The file is read in chunks from loop() by the UbloxAssistNow state machine.
+void LocationService::startOfflineAssist()
+{
+    if(!GNSS_ASSIST_OFFLINE || !SD.exists(GNSS_ASSIST_FILE))
+        return;
+
+    if(assistFile)
+        assistFile.close();
+    assistFile = SD.open(GNSS_ASSIST_FILE, O_READ);
+    if(!assistFile)
+        return;
+
+    Log.info("GNSS offline assistance: %lu bytes", assistFile.size());
+    assistNow.withOfflineSource([](uint8_t *buf, size_t len) {
+        if(!assistFile)
+            return 0;
+        int count = assistFile.read(buf, len);
+        if(count <= 0)
+        {
+            assistFile.close();
+            return 0;
+        }
+        return count;
+    });
+}
+
+// 0 = no fix, 1 = GNSS fix, 2 = interpolated by dead-reckoning, of the last updatePosition()
+String LocationService::getFixType()
+{
+    if(location_started)
+        return String(fix_type);
+    else
+        return "na";
+}
+
+// Keeps the last valid fix and, while the GNSS has no fix, propagates it using the last
+// speed and course. The speed is corrected with the mean forward acceleration since the
+// previous step and zeroed when the motion service reports the vehicle as still.
+void LocationService::updateDeadReckoning()
+{
+    unsigned long now = millis();
+    TinyGPSPlus *tgps = gps.getTinyGPSPlus();
+
+    if(gps.gpsFix())
+    {
+        TinyGPSLocation location = tgps->getLocation();
+        TinyGPSSpeed speed = tgps->getSpeed();
+        TinyGPSCourse course = tgps->getCourse();
+        dr_lat = location.lat();
+        dr_lon = location.lng();
+        warm_start.magic = WARM_START_MAGIC;
+        warm_start.lat = dr_lat;
+        warm_start.lon = dr_lon;
+        warm_start.alt = tgps->getAltitude().meters();
+        if(speed.isValid())
+            dr_speed = speed.mps();
+        if(course.isValid())
+            dr_course = course.deg();
+        dr_fix_time = now;
+        dr_last_time = now;
+        fix_type = FIX_GNSS;
+        MotionService::instance().getForwardAccel();   // restart the mean at the fix
+        return;
+    }
+
+    if(!DEAD_RECKONING || dr_fix_time == 0 || now - dr_fix_time > DR_MAX_INTERVAL * 1000UL)
+    {
+        fix_type = FIX_NONE;
+        return;
+    }
+
+    float dt = (now - dr_last_time) / 1000.0;
+    dr_last_time = now;
+
+    float mean_accel = MotionService::instance().getForwardAccel();
+    float last_speed = dr_speed;
+    if(MotionService::getInactivityCounter() >= DR_STILL_TIME)
+        dr_speed = 0;
+    else
+        dr_speed += mean_accel * GRAVITY * dt;
+    dr_speed = constrain(dr_speed, 0.0f, (float)DR_MAX_SPEED);
+
+    double distance = (last_speed + dr_speed) / 2 * dt;
+    double course = dr_course * M_PI / 180.0;
+    double lat = dr_lat * M_PI / 180.0;
+    dr_lat += (distance * cos(course) / EARTH_RADIUS) * 180.0 / M_PI;
+    dr_lon += (distance * sin(course) / (EARTH_RADIUS * cos(lat))) * 180.0 / M_PI;
+    fix_type = FIX_DEAD_RECKONING;
+}
 String LocationService::getGPStime()
 {
 	if (location_started){
@@ -22,18 +22,70 @@ class LocationService {
         }
         return *_instance;
     }
+    enum FixTypes
+    {
+        FIX_NONE,
+        FIX_GNSS,
+        FIX_DEAD_RECKONING
+    };
+
+    enum GpsProfiles
+    {
+        GPS_PROFILE_OFF,
+        GPS_PROFILE_MOVING,
+        GPS_PROFILE_PARKED
+    };
+
     int start();
     int stop();
+    void loop();
+    int setProfile(uint8_t profile);
+    uint8_t gps_profile = GPS_PROFILE_OFF;      // profile acknowledged by the receiver
     bool location_started = false;
+    void updatePosition(void);
     String getGPSdata(void);
     String getGPStime(void);
     String getEpochTime(void);
+    String getFixType(void);
 
 
 
     private:
         LocationService();
         static LocationService *_instance;
+        void updateDeadReckoning(void);
+        void saveWarmStart(void);
+        void restoreWarmStart(void);
+        void runWarmStart(void);
+        bool restoreMessage(void);
+        void startOfflineAssist(void);
+        void runProfile(void);
+        void profileAck(uint8_t reason);
+        // Profile being configured, one CFG message at a time, each waiting for its ACK
+        uint8_t profile_target = GPS_PROFILE_OFF;
+        uint8_t profile_applying = GPS_PROFILE_OFF;
+        uint8_t profile_step = 0;
+        bool profile_busy = false;          // waiting for the ACK of the last message
+        bool profile_failed = false;        // sent again GPS_PROFILE_RETRY after profile_fail_time
+        unsigned long profile_fail_time = 0;
+        enum WarmStartStates
+        {
+            DBD_IDLE,
+            DBD_RESTORING,      // GNSS_DBD_FILE sent to the receiver
+            DBD_SAVING,         // MGA-DBD poll written to the temporary file
+            DBD_SAVED           // poll complete, the temporary file replaces GNSS_DBD_FILE
+        };
+        uint8_t dbd_state = DBD_IDLE;
+        size_t dbd_messages = 0;
+        unsigned long dbd_time = 0;     // millis() of the last restored message or save
+        uint8_t fix_type = FIX_NONE;
+        String position = "na,na";     // lat,lon of the last updatePosition()
+        double dr_lat = 0;
+        double dr_lon = 0;
+        float dr_speed = 0;             // m/s
+        float dr_course = 0;            // degrees from north
+        unsigned long dr_fix_time = 0;  // millis() of the last valid GNSS fix
+        unsigned long dr_last_time = 0; // millis() of the last propagation step
 
 
 };
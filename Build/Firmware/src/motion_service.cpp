@@ -1,7 +1,9 @@
 #include "Particle.h"
 #include "motion_service.h"
+#include "cityscanner_trace.h"
+#include "cityscanner_settings.h"
 
-float   sampleRate = 6.25;  // HZ - Samples per second - 0.781, 1.563, 3.125, 6.25, 12.5, 25, 50, 100, 200, 400, 800, 1600Hz
+float   sampleRate = MOTION_PIPELINE ? MOTION_SAMPLE_RATE : 6.25;  // HZ - Samples per second - 0.781, 1.563, 3.125, 6.25, 12.5, 25, 50, 100, 200, 400, 800, 1600Hz
 uint8_t accelRange = 2;     // Accelerometer range = 2, 4, 8, 16g
 
 int32_t result;
@@ -9,16 +11,24 @@ int32_t result;
 KXTJ3 myIMU(0x0E); // Address can be 0x0E or 0x0F
 
 MotionService *MotionService::_instance = nullptr;
-int MotionService::inactivity_counter = 0;
+volatile unsigned long MotionService::last_motion = 0;
+volatile bool MotionService::inactive = false;
 
 
+// Fires once, INACTIVITY_TIME seconds after the last motion interrupt
 void MotionService::timer_fnc(){
-   inactivity_counter++;
-   Serial.print("Inactivity counter: ");Serial.println(inactivity_counter);
+   inactive = true;
 }
 
 
-Timer inactivity_timer(1000, MotionService::timer_fnc);
+Timer inactivity_timer(INACTIVITY_TIME * 1000UL, MotionService::timer_fnc, true);
+
+// KXTJ3 wake-up (motion) interrupt, re-arms the inactivity timer
+void MotionService::motionISR(){
+    last_motion = millis();
+    inactive = false;
+    inactivity_timer.resetFromISR();
+}
 
 MotionService::MotionService() {
 }
@@ -51,7 +61,15 @@ int MotionService::start()
     errorAccumulator += myIMU.writeRegister(LSM6DSL_ACC_GYRO_INT_DUR2, 0x7F);
     errorAccumulator += myIMU.writeRegister(LSM6DSL_ACC_GYRO_WAKE_UP_THS, 0x80);
     errorAccumulator += myIMU.writeRegister(LSM6DSL_ACC_GYRO_MD1_CFG, 0x48);*/
-        if( myIMU.begin(sampleRate, accelRange) != 0 )
+        uint8_t readData = 0;
+        int status = 0;
+        WITH_LOCK(Wire) {
+            status = myIMU.begin(sampleRate, accelRange);
+            myIMU.intConf(123, 1, 10, LOW);         // Need to adjust threshold value here
+            // Get the ID:
+            myIMU.readRegister(&readData, KXTJ3_WHO_AM_I);
+        }
+        if( status != 0 )
         {
             Serial.print("Failed to initialize IMU.\n");
         }
@@ -60,12 +78,6 @@ int MotionService::start()
             Serial.print("IMU initialized.\n");
         }
 
-        myIMU.intConf(123, 1, 10, LOW);         // Need to adjust threshold value here
-
-        uint8_t readData = 0;
-
-        // Get the ID:
-        myIMU.readRegister(&readData, KXTJ3_WHO_AM_I);
         Serial.print("Who am I? 0x");
         Serial.println(readData, HEX);
     }
@@ -93,17 +105,20 @@ int MotionService::start()
 	{
 		Serial.println("Device O.K.");
 	}
-    attachInterrupt(WKP, MotionService::resetInactivityCounter, FALLING);
-    inactivity_timer.start();	
-    attachInterrupt(WKP, resetInactivityCounter, RISING);
+    // The KXTJ3 interrupt is active LOW and unlatched, it pulses on every motion event
+    resetInactivityCounter();
+    attachInterrupt(INT_ACC, motionISR, FALLING);
     Serial.println("timer started");
     motionservice_started = true;
+    if(MOTION_PIPELINE && motion_thread == NULL)
+        motion_thread = new Thread("motion", threadFunction, this, OS_THREAD_PRIORITY_DEFAULT, 1024);
     return true;
 }
 
 int MotionService::stop()
 {
-    inactivity_timer.dispose();	
+    detachInterrupt(INT_ACC);
+    inactivity_timer.stop();
     motionservice_started = false;
     return 1;
 }
@@ -117,10 +132,10 @@ int MotionService::waitOnEvent()
 
 void MotionService::loop()
 {
-    if(inactivity_counter > INACTIVITY_TIME){
-        Serial.println("motion service loop inactivity timer");
+    if(inactive){
+        TRACE(TRACE_INACTIVE, getInactivityCounter(), 0);
         resetInactivityCounter();
-        if(AUTOSLEEP && !OVVERRIDE_AUTOSLEEP){
+        if(CitySettings::instance().get().autosleep && !OVVERRIDE_AUTOSLEEP){
         Serial.println("It's time to get some sleep");
         delay(100);
         CitySleep::instance().stop();
@@ -129,12 +144,15 @@ void MotionService::loop()
 }
 
 void MotionService::resetInactivityCounter(){
-    inactivity_counter = 0;
+    last_motion = millis();
+    inactive = false;
+    inactivity_timer.reset();
 }
 
+// Seconds since the last motion interrupt
 int MotionService::getInactivityCounter()
 {
-    return inactivity_counter;
+    return (millis() - last_motion) / 1000;
 }
 
 void MotionService::setOverrideAutosleep(bool override)
@@ -145,15 +163,233 @@ void MotionService::setOverrideAutosleep(bool override)
         OVVERRIDE_AUTOSLEEP = FALSE;
 }
 
+// Mean acceleration along the direction of travel in g since the previous call, used by the
+// location dead-reckoning. Without the pipeline it is a single reading.
+float MotionService::getForwardAccel()
+{
+    if(!motionservice_started)
+        return 0;
+    if(!MOTION_PIPELINE)
+    {
+        float accel = 0;
+        WITH_LOCK(Wire) {
+            accel = myIMU.axisAccel(DR_FORWARD_AXIS);
+        }
+        return accel;
+    }
+    float sum;
+    uint32_t samples;
+    SINGLE_THREADED_BLOCK() {
+        sum = forward_sum;
+        samples = forward_samples;
+        forward_sum = 0;
+        forward_samples = 0;
+    }
+    return samples ? sum / samples : 0;
+}
+
+// Samples the accelerometer at MOTION_SAMPLE_RATE, reading the three axes in one I2C transaction
+void MotionService::threadFunction(void *param)
+{
+    MotionService *service = (MotionService *)param;
+    system_tick_t last_wake = millis();
+    int16_t raw[3];
+
+    while(true)
+    {
+        os_thread_delay_until(&last_wake, 1000 / MOTION_SAMPLE_RATE);
+        if(!service->motionservice_started)
+            continue;
+
+        kxtj3_status_t status;
+        WITH_LOCK(Wire) {
+            status = myIMU.readAxes(raw);
+        }
+        if(status == IMU_SUCCESS)
+            service->addSample(raw);
+    }
+}
+
+// Stores the sample in the ring buffer and updates the features. Gravity is tracked with a
+// slow average per axis, what is left is vibration. Jerk is the change of acceleration
+// between two samples, start/stop events come from the vibration level with hysteresis.
+void MotionService::addSample(const int16_t *raw)
+{
+    float accel[3], vib = 0, jerk = 0;
+    for(int i = 0; i < 3; i++)
+        accel[i] = myIMU.rawToG(raw[i]);
+
+    SINGLE_THREADED_BLOCK() {
+        ring[ring_head].x = raw[0];
+        ring[ring_head].y = raw[1];
+        ring[ring_head].z = raw[2];
+        ring_head = (ring_head + 1) % MOTION_RING_SIZE;
+
+        for(int i = 0; i < 3; i++)
+        {
+            if(ring_count == 0)
+            {
+                gravity[i] = accel[i];
+                last_accel[i] = accel[i];
+            }
+            gravity[i] += (accel[i] - gravity[i]) / (2 * MOTION_SAMPLE_RATE);
+            float d = accel[i] - gravity[i];
+            vib += d * d;
+            float j = accel[i] - last_accel[i];
+            jerk += j * j;
+            last_accel[i] = accel[i];
+        }
+        ring_count++;
+
+        jerk = sqrt(jerk) * MOTION_SAMPLE_RATE;
+        if(jerk > jerk_max)
+            jerk_max = jerk;
+        vib_sum += vib;
+        vib_samples++;
+
+        vib_ema += (vib - vib_ema) / MOTION_SAMPLE_RATE;
+        float level = sqrt(vib_ema);
+        if(!moving && level > MOTION_MOVING_RMS)
+        {
+            moving = true;
+            motion_starts++;
+        }
+        else if(moving && level < MOTION_MOVING_RMS / 2)
+        {
+            moving = false;
+            motion_stops++;
+        }
+
+        // The forward offset of the mounting is learnt only while still, so a sustained
+        // acceleration is kept in the dead-reckoning mean instead of being averaged out
+        float forward = accel[DR_FORWARD_AXIS];
+        if(ring_count == 1)
+            forward_bias = forward;
+        else if(!moving)
+            forward_bias += (forward - forward_bias) / (2 * MOTION_SAMPLE_RATE);
+        forward_sum += forward - forward_bias;
+        forward_samples++;
+    }
+}
+
+// vibration_rms (g), jerk_max (g/s), starts, stops, moving since the last call
+String MotionService::getMOTIONdata()
+{
+    if(!MOTION_PIPELINE || !motionservice_started)
+        return "na,na,na,na,na";
+
+    float sum, jerk;
+    uint32_t samples;
+    uint16_t starts, stops;
+    bool state;
+    SINGLE_THREADED_BLOCK() {
+        sum = vib_sum;
+        samples = vib_samples;
+        jerk = jerk_max;
+        starts = motion_starts;
+        stops = motion_stops;
+        state = moving;
+        vib_sum = 0;
+        vib_samples = 0;
+        jerk_max = 0;
+        motion_starts = 0;
+        motion_stops = 0;
+    }
+    float rms = samples ? sqrt(sum / samples) : 0;
+    return String::format("%.3f,%.2f,%u,%u,%d", rms, jerk, starts, stops, state);
+}
+
+const int vib_bands[] = VIB_BANDS;
+#define VIB_BAND_COUNT (sizeof(vib_bands) / sizeof(vib_bands[0]))
+#define GOERTZEL_Q 14 //fractional bits of the coefficients
+
+// Fixed-point Goertzel filter for one axis, returns the RMS amplitude of the bin in raw >> 4 counts.
+// coeff is 2*cos(2*pi*k/N) in Q14, the axis mean is removed first so gravity does not leak in.
+int32_t MotionService::goertzel(const MotionSample *samples, int count, uint8_t axis, int32_t coeff)
+{
+    int16_t values[MOTION_RING_SIZE];
+    int32_t mean = 0;
+    for(int i = 0; i < count; i++)
+    {
+        values[i] = (axis == X ? samples[i].x : axis == Y ? samples[i].y : samples[i].z) >> 4;
+        mean += values[i];
+    }
+    mean /= count;
+
+    int32_t s1 = 0, s2 = 0;
+    for(int i = 0; i < count; i++)
+    {
+        int32_t s = values[i] - mean + (int32_t)(((int64_t)coeff * s1) >> GOERTZEL_Q) - s2;
+        s2 = s1;
+        s1 = s;
+    }
+    int64_t power = (int64_t)s1 * s1 + (int64_t)s2 * s2 - ((((int64_t)coeff * s1) >> GOERTZEL_Q) * s2);
+    if(power < 0)
+        power = 0;
+    return (int32_t)(sqrt((double)(2 * power)) / count);
+}
+
+// Vibration amplitude in mg for each band of VIB_BANDS, all axes combined, over the ring buffer
+String MotionService::getVIBRATIONdata()
+{
+    String data;
+    MotionSample samples[MOTION_RING_SIZE];
+    int count = 0;
+    if(MOTION_PIPELINE && motionservice_started)
+        count = getSamples(samples, MOTION_RING_SIZE);
+
+    for(unsigned int b = 0; b < VIB_BAND_COUNT; b++)
+    {
+        if(b > 0)
+            data += ",";
+        if(count < MOTION_RING_SIZE)
+        {
+            data += "na";
+            continue;
+        }
+        int32_t coeff = (int32_t)(2 * cos(2 * M_PI * vib_bands[b] / MOTION_SAMPLE_RATE) * (1 << GOERTZEL_Q));
+        float amplitude = 0;
+        for(uint8_t axis = X; axis <= Z; axis++)
+        {
+            float a = goertzel(samples, count, axis, coeff);
+            amplitude += a * a;
+        }
+        data += String(myIMU.rawToG(16) * sqrt(amplitude) * 1000, 1);
+    }
+    return data;
+}
+
+// Copies the latest count raw samples, oldest first. Returns the number of samples copied.
+int MotionService::getSamples(MotionSample *samples, int count)
+{
+    SINGLE_THREADED_BLOCK() {
+        if(count > MOTION_RING_SIZE)
+            count = MOTION_RING_SIZE;
+        if((uint32_t)count > ring_count)
+            count = ring_count;
+        uint16_t index = (ring_head + MOTION_RING_SIZE - count) % MOTION_RING_SIZE;
+        for(int i = 0; i < count; i++)
+        {
+            samples[i] = ring[index];
+            index = (index + 1) % MOTION_RING_SIZE;
+        }
+    }
+    return count;
+}
+
 void MotionService::testAccelerometer()
 {  
+  int16_t raw[3];
+  WITH_LOCK(Wire) {
+    myIMU.readAxes(raw);
+  }
   Serial.print("\nAccelerometer:\n");
   Serial.print(" X = ");
-  Serial.println(myIMU.axisAccel( X ), 4);
+  Serial.println(myIMU.rawToG( raw[X] ), 4);
   Serial.print(" Y = ");
-  Serial.println(myIMU.axisAccel( Y ), 4);
+  Serial.println(myIMU.rawToG( raw[Y] ), 4);
   Serial.print(" Z = ");
-  Serial.println(myIMU.axisAccel( Z ), 4);
+  Serial.println(myIMU.rawToG( raw[Z] ), 4);
   /*Serial.print("\nGyroscope:\n");
   Serial.print(" X = ");
   Serial.println(myIMU.readFloatGyroX(), 4);
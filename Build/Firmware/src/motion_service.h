@@ -4,6 +4,14 @@
 #include "cityscanner_CONFIG.h"
 #include "cityscanner_sleep.h"
 
+#define MOTION_RING_SIZE 64 //samples, 2.56s at 25Hz
+
+struct MotionSample
+{
+    int16_t x;
+    int16_t y;
+    int16_t z;
+};
 
 
 class MotionService {
@@ -34,6 +42,10 @@ class MotionService {
     bool OVVERRIDE_AUTOSLEEP = false;
     void setOverrideAutosleep(bool);
     void testAccelerometer();
+    float getForwardAccel(void);
+    String getMOTIONdata(void);
+    String getVIBRATIONdata(void);
+    int getSamples(MotionSample *samples, int count);
     static void resetInactivityCounter();
     static int getInactivityCounter(void);
     void loop();
@@ -41,6 +53,29 @@ class MotionService {
     private:
         MotionService();
         static MotionService *_instance;
-        static int inactivity_counter;
+        static volatile unsigned long last_motion; // millis() of the last motion interrupt
+        static volatile bool inactive;              // set by the inactivity timer
+        static void motionISR(void);
+        static void threadFunction(void *param);
+        void addSample(const int16_t *raw);
+        int32_t goertzel(const MotionSample *samples, int count, uint8_t axis, int32_t coeff);
+        Thread *motion_thread = NULL;
+        MotionSample ring[MOTION_RING_SIZE];
+        uint16_t ring_head = 0;         // index of the next sample to write
+        uint32_t ring_count = 0;        // samples written since start
+        float gravity[3] = {0, 0, 0};   // slow average of each axis in g, removed before the features
+        float last_accel[3] = {0, 0, 0};
+        float vib_ema = 0;              // ~1s average of the squared vibration, drives the moving state
+        bool moving = false;
+        // Accumulated since the last getMOTIONdata()
+        float vib_sum = 0;
+        uint32_t vib_samples = 0;
+        float jerk_max = 0;
+        uint16_t motion_starts = 0;
+        uint16_t motion_stops = 0;
+        // Forward acceleration for the dead-reckoning, accumulated since the last getForwardAccel()
+        float forward_bias = 0;         // g, forward axis at rest
+        float forward_sum = 0;
+        uint32_t forward_samples = 0;
 
 };
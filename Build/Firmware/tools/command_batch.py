@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Build and decode command batches for the binary command channel of the Cityscanner.
+
+A batch holds several commands, each [type][length][value]. Send the hex string to
+the "CMD" cloud function, the results come back hex encoded in a "CMD" event, one
+[type][status][length][value] per command. Over Serial batches and results travel
+in frames [0x7E][length lo][length hi][payload][crc8].
+
+    python3 command_batch.py ping config "config_set sample_rate=10" "sd_dump 3" "text sd,files"
+    python3 command_batch.py "sd_dump 0 7/40"       (all files in slot 7 of 40)
+    particle call <device> CMD $(python3 command_batch.py stats "config_set records=100")
+    python3 command_batch.py --decode 0100073432...
+    python3 command_batch.py --serial /dev/ttyACM0 ping stats      (needs pyserial)
+"""
+import struct
+import sys
+
+# Keep in sync with CommandTypes in src/cityscanner_cli.h
+COMMANDS = {
+    "ping": 1,
+    "config": 2,
+    "config_set": 3,        # name=value
+    "config_reset": 4,
+    "sd_files": 5,
+    "sd_dump": 6,           # files (0 or none for all) [slot/slots or slots]
+    "stats": 7,
+    "profile": 8,
+    "trace_last": 9,        # max length
+    "text": 10,             # any text CLI command
+}
+NUMBER_COMMANDS = ("trace_last",)
+NAMES = {value: name for name, value in COMMANDS.items()}
+STATUS = {0: "ok", 0xFF: "invalid", 0xFE: "unknown", 0xFD: "truncated"}
+FRAME_START = 0x7E
+
+
+def dump_value(words):
+    """files [slot/slots | slots], without slot the device derives it from its ID"""
+    if not words:
+        return b""
+    if len(words) == 1:
+        return struct.pack("<H", int(words[0]))
+    slot, _, slots = words[1].rpartition("/")
+    return struct.pack("<HHH", int(words[0]), int(slot) if slot else 0xFFFF, int(slots))
+
+
+def encode(commands):
+    batch = b""
+    for command in commands:
+        name, _, argument = command.partition(" ")
+        if name == "sd_dump":
+            value = dump_value(argument.split())
+        elif name in NUMBER_COMMANDS:
+            value = struct.pack("<H", int(argument)) if argument else b""
+        else:
+            value = argument.encode()
+        batch += bytes([COMMANDS[name], len(value)]) + value
+    return batch
+
+
+def decode(results):
+    i = 0
+    while i + 3 <= len(results):
+        kind, status, length = results[i], results[i + 1], results[i + 2]
+        value = results[i + 3:i + 3 + length].decode(errors="replace")
+        yield NAMES.get(kind, str(kind)), STATUS.get(status, str(status)), value
+        i += 3 + length
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def serial_call(port, batch):
+    import serial
+    with serial.Serial(port, 115200, timeout=30) as link:
+        link.write(bytes([FRAME_START]) + struct.pack("<H", len(batch)) + batch + bytes([crc8(batch)]))
+        while link.read(1) != bytes([FRAME_START]):
+            pass    # skip log lines
+        length = struct.unpack("<H", link.read(2))[0]
+        results = link.read(length)
+        if link.read(1) != bytes([crc8(results)]):
+            raise IOError("bad CRC in the answer")
+        return results
+
+
+def main():
+    args = sys.argv[1:]
+    if args and args[0] == "--decode":
+        results = bytes.fromhex(args[1])
+    elif args and args[0] == "--serial":
+        results = serial_call(args[1], encode(args[2:]))
+    else:
+        print(encode(args).hex())
+        return
+    for name, status, value in decode(results):
+        print("%-12s %-9s %s" % (name, status, value))
+
+
+if __name__ == "__main__":
+    main()
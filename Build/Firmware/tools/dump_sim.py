@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Simulate a fleet dumping its SD queues to one TCP endpoint and report throughput and tail latency.
+
+Each device follows CityStore::scheduleDump(), loop() and dumpData() in
+src/cityscanner_store.cpp, the defaults follow src/cityscanner_config.h:
+the dump starts at a random time within DUMP_JITTER, or within the slot of the
+device when --slots is given; files are sent one after the other on one
+connection; a chunk the endpoint does not take within DUMP_WRITE_TIMEOUT aborts
+the file, which stays in the queue; a failed dump is retried after a randomized
+exponential backoff, at most DUMP_RETRIES times.
+
+The endpoint shares --bandwidth between its open connections and refuses
+connections beyond --connections. Latency is from the dump command to the last
+file of a device. Exits with 1 when a device gives up.
+
+    python3 dump_sim.py --devices 300 --bandwidth 30000 --connections 500
+    python3 dump_sim.py --devices 300 --bandwidth 30000 --connections 500 --slots 30 --slot-length 60
+    python3 dump_sim.py --devices 300 --bandwidth 30000 --connections 500 --jitter 0 --retries 0
+"""
+import argparse
+import random
+import sys
+
+CHUNK = 512  # DUMP_CHUNK_SIZE in src/cityscanner_store.h
+
+
+class Device:
+    def __init__(self, index, args, rng):
+        self.args = args
+        self.rng = rng
+        self.files = args.files
+        self.sent = 0           # bytes of the current file
+        self.stalled = 0.0      # seconds since the last full chunk
+        self.attempt = 0
+        self.connected = False
+        self.done_at = None
+        self.failed = False
+        if args.slots == 0:
+            self.start = rng.uniform(0, args.jitter)
+        else:
+            self.start = (index % args.slots) * args.slot_length + rng.uniform(0, args.slot_length)
+
+    def due(self, t):
+        return not self.connected and self.done_at is None and not self.failed and t >= self.start
+
+    def retry(self, t):
+        """loop() after dumpData() returned false"""
+        self.connected = False
+        self.attempt += 1
+        if self.attempt > self.args.retries:
+            self.failed = True
+            return
+        backoff = min(self.args.backoff_base << (self.attempt - 1), self.args.backoff_max)
+        self.start = t + backoff / 2 + self.rng.uniform(0, backoff / 2)
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p / 100.0 * len(values)))]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--devices", type=int, default=100)
+    parser.add_argument("--files", type=int, default=10, help="files in the queue of each device")
+    parser.add_argument("--file-size", type=int, default=40000, help="bytes")
+    parser.add_argument("--bandwidth", type=float, default=1e6, help="bytes/s taken by the endpoint")
+    parser.add_argument("--device-rate", type=float, default=20e3, help="bytes/s of one device uplink")
+    parser.add_argument("--connections", type=int, default=64, help="connections the endpoint accepts at once")
+    parser.add_argument("--jitter", type=float, default=30, help="DUMP_JITTER, seconds")
+    parser.add_argument("--slots", type=int, default=0, help="slots given by the server, 0 for jitter only")
+    parser.add_argument("--slot-length", type=float, default=20, help="DUMP_SLOT_LENGTH, seconds")
+    parser.add_argument("--retries", type=int, default=5, help="DUMP_RETRIES")
+    parser.add_argument("--backoff-base", type=int, default=30, help="DUMP_BACKOFF_BASE, seconds")
+    parser.add_argument("--backoff-max", type=int, default=900, help="DUMP_BACKOFF_MAX, seconds")
+    parser.add_argument("--write-timeout", type=float, default=5, help="DUMP_WRITE_TIMEOUT, seconds")
+    parser.add_argument("--step", type=float, default=0.1, help="simulation step, seconds")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    devices = [Device(i, args, rng) for i in range(args.devices)]
+    delivered = wasted = refused = aborted = 0
+    open_connections = 0
+    t = 0.0
+    while any(d.done_at is None and not d.failed for d in devices):
+        for d in devices:
+            if d.due(t):
+                if open_connections < args.connections:
+                    open_connections += 1
+                    d.connected = True
+                    d.sent = 0
+                    d.stalled = 0.0
+                else:
+                    refused += 1
+                    d.retry(t)
+        active = [d for d in devices if d.connected]
+        if active:
+            rate = min(args.device_rate, args.bandwidth / len(active))
+            for d in active:
+                before = d.sent // CHUNK
+                d.sent += rate * args.step
+                d.stalled = 0.0 if d.sent // CHUNK > before else d.stalled + args.step
+                if d.sent >= args.file_size:
+                    # file moved to the done folder, the next one follows on the same connection
+                    delivered += args.file_size
+                    d.files -= 1
+                    d.sent = 0
+                    if d.files == 0:
+                        open_connections -= 1
+                        d.connected = False
+                        d.done_at = t
+                elif d.stalled > args.write_timeout:
+                    # sendChunk() gave up, the file stays in the queue and is sent again in full
+                    wasted += int(d.sent)
+                    aborted += 1
+                    open_connections -= 1
+                    d.retry(t)
+        t += args.step
+
+    latencies = [d.done_at for d in devices if d.done_at is not None]
+    failed = sum(d.failed for d in devices)
+    print("devices            %d, %d files of %d B each" % (args.devices, args.files, args.file_size))
+    print("finished           %d, gave up %d" % (len(latencies), failed))
+    print("makespan           %.0f s" % t)
+    print("throughput         %.0f B/s (%.0f%% of the endpoint)" % (delivered / t, 100.0 * delivered / t / args.bandwidth))
+    print("refused connects   %d" % refused)
+    print("aborted files      %d, %d B sent again" % (aborted, wasted))
+    if latencies:
+        print("latency p50/p95/p99/max  %.0f / %.0f / %.0f / %.0f s" % (
+            percentile(latencies, 50), percentile(latencies, 95), percentile(latencies, 99), max(latencies)))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
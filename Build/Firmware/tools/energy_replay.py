@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""Replay a battery voltage trace through the energy planner and count the tier changes.
+
+The planner runs once every ROUTINE_RATE seconds and is mirrored from CitySleep::plan()
+in src/cityscanner_sleep.cpp, the defaults follow src/cityscanner_config.h. The trace is
+either data files from the SD card (their Vitals records) or a plain CSV of
+seconds,volt[,solar mA] lines. A trace logged with the OPC on does not show the lift
+of the battery voltage once SAVE turns it off, --save-lift adds it back while in SAVE.
+Exits with 1 when the tier changes more often than --max-changes per day.
+
+    python3 energy_replay.py queue/*.csv active.csv
+    python3 energy_replay.py --save-lift 0.08 trace.csv
+    python3 energy_replay.py --dwell 10 --exit 0.15 trace.csv
+"""
+import argparse
+import sys
+
+from record_decode import decode_binary, decode_csv, read_header
+
+VITALS = 1  # payloadType in src/cityscanner_store.h
+TIERS = ("NORMAL", "SAVE", "CRITICAL")
+
+
+def vitals(path):
+    data = open(path, "rb").read()
+    layouts, record_format, offset = read_header(data)
+    if record_format == "binary":
+        records = decode_binary(layouts, data, offset)
+    else:
+        records = decode_csv(layouts, data[offset:].decode(errors="replace").splitlines())
+    for record in records:
+        if record.get("payload_type") == VITALS and record.get("voltage_batt") is not None:
+            yield record["timestamp"], record["voltage_batt"], record.get("current_solar") or 0.0
+
+
+def plain(path):
+    for line in open(path):
+        fields = line.strip().split(",")
+        try:
+            values = [float(f) for f in fields]
+        except ValueError:
+            continue  # header or comment
+        yield values[0], values[1], values[2] if len(values) > 2 else 0.0
+
+
+def load(paths):
+    points = []
+    for path in paths:
+        with open(path, "rb") as f:
+            is_data_file = f.read(1) == b"#"
+        points.extend(vitals(path) if is_data_file else plain(path))
+    return sorted(points)
+
+
+class Planner:
+    """CitySleep::plan() and getBatterySlope()"""
+
+    def __init__(self, args):
+        self.args = args
+        self.history = []
+        self.tier = 0
+        self.tier_runs = 0
+
+    def slope(self):
+        n = len(self.history)
+        if n < 2:
+            return 0.0
+        xs = [i * self.args.routine / 3600.0 for i in range(n)]
+        sum_x, sum_y = sum(xs), sum(self.history)
+        sum_xx = sum(x * x for x in xs)
+        sum_xy = sum(x * y for x, y in zip(xs, self.history))
+        den = n * sum_xx - sum_x * sum_x
+        return (n * sum_xy - sum_x * sum_y) / den if den else 0.0
+
+    def plan(self, battery_v):
+        a = self.args
+        self.history = (self.history + [battery_v])[-a.history:]
+        tier = self.tier
+        if battery_v < a.low:
+            tier = 2
+        else:
+            projected = battery_v + self.slope() * a.horizon
+            if self.tier_runs < a.dwell:
+                pass
+            elif projected < a.low + a.enter:
+                tier = 1
+            elif projected > a.low + a.exit:
+                tier = 0
+        if tier != self.tier:
+            self.tier = tier
+            self.tier_runs = 0
+            self.history = self.history[-1:]
+        if self.tier_runs < a.dwell:
+            self.tier_runs += 1
+        return self.tier
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("files", nargs="+")
+    parser.add_argument("--routine", type=float, default=60, help="ROUTINE_RATE, seconds")
+    parser.add_argument("--low", type=float, default=3.80, help="LOW_BATTERY_THRESHOLD, volt")
+    parser.add_argument("--history", type=int, default=30, help="ENERGY_HISTORY, runs")
+    parser.add_argument("--horizon", type=float, default=2, help="ENERGY_HORIZON, hours")
+    parser.add_argument("--enter", type=float, default=0.10, help="ENERGY_SAVE_ENTER, volt")
+    parser.add_argument("--exit", type=float, default=0.25, help="ENERGY_SAVE_EXIT, volt")
+    parser.add_argument("--dwell", type=int, default=30, help="ENERGY_MIN_DWELL, runs")
+    parser.add_argument("--save-lift", type=float, default=0.0, help="volt added to the trace while in SAVE")
+    parser.add_argument("--max-changes", type=float, default=6, help="tier changes per day")
+    parser.add_argument("--quiet", action="store_true", help="only print the summary")
+    args = parser.parse_args()
+
+    points = load(args.files)
+    if len(points) < 2:
+        print("fewer than 2 battery readings")
+        return 1
+
+    planner = Planner(args)
+    start, end = points[0][0], points[-1][0]
+    seconds = [0.0] * len(TIERS)
+    changes = 0
+    index = 0
+    t = start
+    while t <= end:
+        while index + 1 < len(points) and points[index + 1][0] <= t:
+            index += 1
+        battery_v = points[index][1] + (args.save_lift if planner.tier == 1 else 0.0)
+        previous = planner.tier
+        tier = planner.plan(battery_v)
+        if tier != previous:
+            changes += 1
+            if not args.quiet:
+                print("%8.2f h  %.2f V  %s -> %s" % ((t - start) / 3600.0, battery_v, TIERS[previous], TIERS[tier]))
+        seconds[tier] += args.routine
+        t += args.routine
+
+    days = max((end - start) / 86400.0, 1 / 24.0)
+    print("trace              %.1f h, %d readings" % ((end - start) / 3600.0, len(points)))
+    print("tier changes       %d (%.1f per day)" % (changes, changes / days))
+    for name, spent in zip(TIERS, seconds):
+        print("%-18s %.1f h" % (name, spent / 3600.0))
+    if changes / days > args.max_changes:
+        print("FAIL more than %g tier changes per day" % args.max_changes)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,239 @@
+// Host driver for tools/expander_model.py: runs lib/cscore/src/CS_core.cpp against a model of the two
+// PCA9554 expanders on the I2C bus and checks the transaction API (shadow registers, coalesced writes
+// on commit, input snapshot). Built with a stub Particle.h and Wire.h, see expander_model.py.
+#include <map>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#define private public
+#include "CS_core.h"
+#include "I2C_trace.h"
+#undef private
+
+#define GPIO_A 0x20
+#define GPIO_B 0x21
+#define REG_INP 0
+#define REG_OUT 1
+#define REG_POL 2
+#define REG_CTRL 3
+
+Logger Log;
+void pinMode(int, int) {}
+void digitalWrite(int, int) {}
+void delay(unsigned long) {}
+
+/***************************************************************************
+ *
+ * PCA9554 model: the first byte of a write selects the register, a second
+ * byte writes it, a read returns the selected register
+ *
+ **************************************************************************/
+struct Expander
+{
+  uint8_t reg[4] = {0x00, 0xFF, 0x00, 0xFF}; // power-on values
+  uint8_t pointer = 0;
+};
+
+static std::map<int, Expander> chips = {{GPIO_A, Expander()}, {GPIO_B, Expander()}};
+static int bus_writes = 0;     // register writes
+static int bus_reads = 0;      // register reads
+static int tx_address = 0;
+static std::vector<uint8_t> tx_bytes;
+static uint8_t rx_byte = 0;
+
+TwoWire Wire;
+void TwoWire::begin() {}
+void TwoWire::beginTransmission(int address)
+{
+  tx_address = address;
+  tx_bytes.clear();
+}
+size_t TwoWire::write(uint8_t data)
+{
+  tx_bytes.push_back(data);
+  return 1;
+}
+size_t TwoWire::write(const uint8_t *data, size_t quantity)
+{
+  tx_bytes.insert(tx_bytes.end(), data, data + quantity);
+  return quantity;
+}
+uint8_t TwoWire::endTransmission(uint8_t)
+{
+  if (!chips.count(tx_address))
+    return 2; // NACK
+  Expander &chip = chips[tx_address];
+  if (tx_bytes.size() > 0)
+    chip.pointer = tx_bytes[0] & 3;
+  for (size_t i = 1; i < tx_bytes.size(); i++)
+  {
+    if (chip.pointer != REG_INP)
+      chip.reg[chip.pointer] = tx_bytes[i];
+    bus_writes++;
+  }
+  return 0;
+}
+uint8_t TwoWire::requestFrom(int address, int quantity, int)
+{
+  rx_byte = chips[address].reg[chips[address].pointer];
+  bus_reads++;
+  return quantity;
+}
+int TwoWire::available() { return 1; }
+int TwoWire::read() { return rx_byte; }
+
+// TracedWire only forwards here, the counters come from the model
+uint8_t TracedWire::endTransmission(uint8_t stop) { return wire.endTransmission(stop); }
+uint8_t TracedWire::requestFrom(int address, int quantity, int stop) { return wire.requestFrom(address, quantity, stop); }
+TracedWire &TracedWire::global()
+{
+  static TracedWire traced(Wire);
+  return traced;
+}
+
+/***************************************************************************
+ *
+ * Checks
+ *
+ **************************************************************************/
+static int failures = 0;
+
+static void check(const char *name, bool ok, const char *format, ...)
+{
+  char detail[128];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(detail, sizeof(detail), format, args);
+  va_end(args);
+  printf("%-4s %-34s %s\n", ok ? "ok" : "FAIL", name, detail);
+  if (!ok)
+    failures++;
+}
+
+// New expanders and a new CS_core, set up by begin() when started is set
+static CS_core &fresh(bool started)
+{
+  chips = {{GPIO_A, Expander()}, {GPIO_B, Expander()}};
+  delete CS_core::_instance;
+  CS_core::_instance = new CS_core();
+  if (started)
+    CS_core::instance().begin(V3);
+  bus_writes = bus_reads = 0;
+  return CS_core::instance();
+}
+
+static bool shadowMatches(CS_core &core)
+{
+  for (int i = 0; i < 2; i++)
+  {
+    Expander &chip = chips[GPIO_A + i];
+    if (chip.reg[REG_OUT] != core.m_out[i] || chip.reg[REG_POL] != core.m_pol[i] || chip.reg[REG_CTRL] != core.m_ctrl[i])
+      return false;
+  }
+  return true;
+}
+
+int main()
+{
+  // begin(): 8 reads of the defaults, then 2 transactions instead of 10 + 4 single writes
+  CS_core &core = fresh(false);
+  core.begin(V3);
+  check("begin() reads", bus_reads == 8, "%d register reads", bus_reads);
+  check("begin() writes", bus_writes == 5, "%d register writes, 14 without transactions", bus_writes);
+  check("begin() registers", shadowMatches(core), "OUT A %02X B %02X, CTRL A %02X B %02X",
+        chips[GPIO_A].reg[REG_OUT], chips[GPIO_B].reg[REG_OUT], chips[GPIO_A].reg[REG_CTRL], chips[GPIO_B].reg[REG_CTRL]);
+
+  // rails off: 4 pins on 2 expanders, one write each
+  bus_writes = 0;
+  core.enableALL(false);
+  check("enableALL(false) writes", bus_writes == 2, "%d register writes, 4 without transactions", bus_writes);
+  check("enableALL(false) registers", shadowMatches(core), "OUT A %02X B %02X", chips[GPIO_A].reg[REG_OUT], chips[GPIO_B].reg[REG_OUT]);
+
+  // rails on keep their sequence, one write per pin
+  bus_writes = 0;
+  core.enableALL(true);
+  check("enableALL(true) writes", bus_writes == 4, "%d register writes, sequenced", bus_writes);
+
+  // outside a transaction every change is written at once
+  bus_writes = 0;
+  core.enableOPC(false);
+  check("single pin write", bus_writes == 1 && shadowMatches(core), "%d register write", bus_writes);
+
+  // nested transactions write on the outermost commit only
+  bus_writes = 0;
+  core.beginTransaction();
+  core.beginTransaction();
+  core.enable3V3(false);
+  core.commit();
+  int inner = bus_writes;
+  core.enable5V(false);
+  core.enableHEATER(false);
+  core.commit();
+  check("nested commit", inner == 0 && bus_writes == 2 && shadowMatches(core), "%d after inner, %d after outer commit", inner, bus_writes);
+
+  // a pin set and cleared in a transaction still writes its register once, with the final value
+  bus_writes = 0;
+  core.beginTransaction();
+  core.enableOPC(true);
+  core.enableOPC(false);
+  core.commit();
+  check("set and clear", bus_writes == 1 && shadowMatches(core), "%d register write", bus_writes);
+
+  // commit() without beginTransaction() is ignored
+  bus_writes = 0;
+  core.commit();
+  core.enableOPC(true);
+  check("unbalanced commit", bus_writes == 1 && core.m_transaction == 0, "%d register write", bus_writes);
+
+  // inputs: read once per expander inside a transaction, every time outside
+  chips[GPIO_B].reg[REG_INP] = 0x01;
+  bus_reads = 0;
+  core.beginTransaction();
+  bool int1 = core.digitalRead_ext(GPIO_B, 0);
+  bool int2 = core.digitalRead_ext(GPIO_B, 1);
+  core.digitalRead_ext(GPIO_A, 0);
+  core.commit();
+  check("input snapshot", bus_reads == 2 && int1 && !int2, "%d register reads for 3 pins on 2 expanders", bus_reads);
+  chips[GPIO_B].reg[REG_INP] = 0x02;
+  bus_reads = 0;
+  int1 = core.digitalRead_ext(GPIO_B, 0);
+  int2 = core.digitalRead_ext(GPIO_B, 1);
+  check("input after commit", bus_reads == 2 && !int1 && int2, "%d register reads, new levels seen", bus_reads);
+
+  // random pin sequences: same registers with and without a transaction, one write per changed register
+  srand(1);
+  for (int trial = 0; trial < 1000 && !failures; trial++)
+  {
+    struct Op { int address, pin; bool value; };
+    std::vector<Op> ops;
+    for (int i = 0, n = 1 + rand() % 8; i < n; i++)
+      ops.push_back({GPIO_A + rand() % 2, rand() % 8, rand() % 2 == 1});
+
+    CS_core &direct = fresh(true);
+    for (const Op &op : ops)
+      direct.digitalWrite_ext(op.address, op.pin, op.value);
+    uint8_t out[2] = {chips[GPIO_A].reg[REG_OUT], chips[GPIO_B].reg[REG_OUT]};
+
+    CS_core &batched = fresh(true);
+    batched.beginTransaction();
+    for (const Op &op : ops)
+      batched.digitalWrite_ext(op.address, op.pin, op.value);
+    int deferred = bus_writes;
+    batched.commit();
+    int expected = 0;
+    for (int i = 0; i < 2; i++)
+      for (const Op &op : ops)
+        if (op.address == GPIO_A + i)
+        {
+          expected++;
+          break;
+        }
+    bool ok = deferred == 0 && bus_writes == expected && shadowMatches(batched) &&
+              out[0] == chips[GPIO_A].reg[REG_OUT] && out[1] == chips[GPIO_B].reg[REG_OUT];
+    if (!ok || trial == 999)
+      check("random sequences", ok, "trial %d: %d ops, %d writes, expected %d", trial, (int)ops.size(), bus_writes, expected);
+  }
+
+  return failures ? 1 : 0;
+}
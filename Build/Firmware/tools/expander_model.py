@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Check the PCA9554 transaction API of CS_core on the host, against a model of the I2C bus.
+
+Builds lib/cscore/src/CS_core.cpp with tools/expander_model.cpp and stub
+Particle.h / Wire.h headers (needs g++). The model counts every register read
+and write of the two expanders. The checks cover begin(), the rail switching,
+nested and unbalanced commits, the input snapshot and random pin sequences,
+which must leave the same registers with and without a transaction and write
+each changed register once. Exits with 1 when a check fails.
+
+    python3 expander_model.py
+"""
+import os
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+LIB = os.path.join(HERE, "..", "lib", "cscore", "src")
+
+PARTICLE_STUB = """#pragma once
+#include <stddef.h>
+#include <stdint.h>
+typedef bool boolean;
+enum { LOW = 0, HIGH = 1 };
+enum { INPUT = 0, OUTPUT = 1 };
+enum { A0 = 100, A1, A5, A6, A7, B0, C4, D5, D6, D7, D23 };
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+void delay(unsigned long ms);
+struct Logger { void info(const char *, ...) {} };
+extern Logger Log;
+#define WITH_LOCK(x) if (true)
+class String;
+"""
+
+WIRE_STUB = """#pragma once
+class TwoWire {
+public:
+  void begin();
+  void beginTransmission(int address);
+  size_t write(uint8_t data);
+  size_t write(const uint8_t *data, size_t quantity);
+  uint8_t endTransmission(uint8_t stop = true);
+  uint8_t requestFrom(int address, int quantity, int stop = true);
+  int available();
+  int read();
+  bool lock() { return true; }
+  bool unlock() { return true; }
+};
+extern TwoWire Wire;
+"""
+
+
+def main():
+    with tempfile.TemporaryDirectory() as workdir:
+        for name, text in (("Particle.h", PARTICLE_STUB), ("Wire.h", WIRE_STUB)):
+            with open(os.path.join(workdir, name), "w") as f:
+                f.write(text)
+        binary = os.path.join(workdir, "expander_model")
+        subprocess.check_call(["g++", "-std=c++11", "-I", workdir, "-I", LIB,
+                               os.path.join(HERE, "expander_model.cpp"), os.path.join(LIB, "CS_core.cpp"),
+                               "-o", binary])
+        return subprocess.call([binary])
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Check the heap columns of the Vitals records of a soak run for leaks and fragmentation.
+
+Run the device for a day or more with HEAP_MONITOR on, copy the data files from the
+SD card and pass them in time order. The heap use is fitted against the timestamp,
+a steady growth is a leak, a largest block shrinking while the free memory does not
+is fragmentation. Exits with 1 when a limit is crossed.
+
+    python3 heap_soak.py queue/*.csv active.csv
+    python3 heap_soak.py --max-growth 200 --min-block 8192 queue/*.bin
+"""
+import argparse
+import sys
+
+from record_decode import decode_binary, decode_csv, read_header
+
+VITALS = 1  # payloadType in src/cityscanner_store.h
+
+
+def vitals(paths):
+    for path in paths:
+        data = open(path, "rb").read()
+        layouts, record_format, offset = read_header(data)
+        if record_format == "binary":
+            records = decode_binary(layouts, data, offset)
+        else:
+            records = decode_csv(layouts, data[offset:].decode(errors="replace").splitlines())
+        for record in records:
+            if record.get("payload_type") == VITALS and record.get("heap_used") is not None:
+                yield record
+
+
+def slope(points):
+    """Least squares slope of (x, y) points"""
+    n = len(points)
+    mean_x = sum(x for x, _ in points) / n
+    mean_y = sum(y for _, y in points) / n
+    sxx = sum((x - mean_x) ** 2 for x, _ in points)
+    sxy = sum((x - mean_x) * (y - mean_y) for x, y in points)
+    return sxy / sxx if sxx else 0.0
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("files", nargs="+")
+    parser.add_argument("--max-growth", type=float, default=100, help="bytes/hour of heap_used")
+    parser.add_argument("--min-block", type=int, default=4096, help="bytes of heap_largest_block")
+    args = parser.parse_args()
+
+    records = [r for r in vitals(args.files) if r.get("timestamp") is not None]
+    if len(records) < 2:
+        print("fewer than 2 Vitals records with heap columns")
+        return 1
+    start = records[0]["timestamp"]
+    hours = (records[-1]["timestamp"] - start) / 3600.0
+    growth = slope([((r["timestamp"] - start) / 3600.0, r["heap_used"]) for r in records])
+    min_block = min(r["heap_largest_block"] for r in records)
+    print("records            %d over %.1f h" % (len(records), hours))
+    print("heap_used          %d -> %d B, %.1f B/h" % (records[0]["heap_used"], records[-1]["heap_used"], growth))
+    print("heap_peak          %d B" % max(r["heap_peak"] for r in records))
+    print("heap_free min      %d B" % min(r["heap_free"] for r in records))
+    print("largest block min  %d B" % min_block)
+    print("free chunks max    %d" % max(r["heap_free_chunks"] for r in records))
+
+    failed = False
+    if growth > args.max_growth:
+        print("FAIL heap_used grows faster than %g B/h" % args.max_growth)
+        failed = True
+    if min_block < args.min_block:
+        print("FAIL largest block below %d B" % args.min_block)
+        failed = True
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,59 @@
+// Host driver for tools/nmea_bench.py: feeds an NMEA log through TinyGPSPlus::encode() with and
+// without filtered mode, prints the decoded values and the parse speed of each mode.
+// Built against lib/gps/src/TinyGPS++.cpp with a stub Particle.h, see nmea_bench.py.
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include "TinyGPS++.h"
+
+uint32_t millis()
+{
+    return 0;
+}
+
+static void run(const std::string &log, bool filtered, int repeat)
+{
+    TinyGPSPlus gps;
+    TinyGPSCustom pdop(gps, "GNGSA", 15);
+    gps.setFilteredMode(filtered);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; r++)
+        for (char c : log)
+            gps.encode(c);
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    printf("mode %s\n", filtered ? "filtered" : "full");
+    printf("bytes_per_us %.2f\n", (double)log.size() * repeat / us);
+    printf("chars %u\n", gps.charsProcessed());
+    printf("with_fix %u\n", gps.sentencesWithFix());
+    printf("failed_checksum %u\n", gps.failedChecksum());
+    printf("skipped %u\n", gps.sentencesSkipped());
+    printf("lat %.7f\n", gps.location.lat());
+    printf("lng %.7f\n", gps.location.lng());
+    printf("date %u\n", gps.date.value());
+    printf("time %u\n", gps.time.value());
+    printf("altitude %d\n", gps.altitude.value());
+    printf("speed %d\n", gps.speed.value());
+    printf("course %d\n", gps.course.value());
+    printf("satellites %u\n", gps.satellites.value());
+    printf("hdop %d\n", gps.hdop.value());
+    printf("pdop %s\n", pdop.value());
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: nmea_bench <log> [repeat]\n");
+        return 2;
+    }
+    std::ifstream file(argv[1], std::ios::binary);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    int repeat = argc > 2 ? atoi(argv[2]) : 1;
+    run(buffer.str(), false, repeat);
+    run(buffer.str(), true, repeat);
+    return 0;
+}
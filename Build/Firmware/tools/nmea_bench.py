@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Check the filtered NMEA mode of TinyGPSPlus::encode() on the host and measure its speed.
+
+Builds lib/gps/src/TinyGPS++.cpp with tools/nmea_bench.cpp and a stub Particle.h
+(needs g++), feeds an NMEA log through encode() with and without filtered mode
+and compares every decoded value, including a custom GNGSA element. Without a
+log, one is generated in the u-blox M8 default output (RMC, VTG, GGA, GSA, GSV,
+GLL once per second). Exits with 1 when the two modes disagree.
+
+    python3 nmea_bench.py
+    python3 nmea_bench.py --repeat 200 drive.nmea
+"""
+import argparse
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+LIB = os.path.join(HERE, "..", "lib", "gps", "src")
+
+PARTICLE_STUB = """#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+typedef uint8_t byte;
+uint32_t millis();
+#define SINGLE_THREADED_BLOCK() if (true)
+"""
+
+# decoded values that must not depend on the mode
+VALUES = ("with_fix", "failed_checksum", "lat", "lng", "date", "time", "altitude",
+          "speed", "course", "satellites", "hdop", "pdop")
+
+
+def sentence(body):
+    checksum = 0
+    for c in body:
+        checksum ^= ord(c)
+    return "$%s*%02X\r\n" % (body, checksum)
+
+
+def ddmm(value, width):
+    value = abs(value)
+    degrees = int(value)
+    return "%0*d%08.5f" % (width, degrees, (value - degrees) * 60)
+
+
+def generate(seconds):
+    """A drive around Cambridge MA, one epoch per second"""
+    lines = []
+    for t in range(seconds):
+        lat = 42.3601 + 0.0002 * math.sin(t / 60.0)
+        lon = -71.0942 + 0.0003 * t / seconds
+        hms = "%02d%02d%02d.00" % (14 + t // 3600, t // 60 % 60, t % 60)
+        ns = "%s,N,%s,W" % (ddmm(lat, 2), ddmm(lon, 3))
+        lines.append(sentence("GNRMC,%s,A,%s,12.5,%.1f,191026,,,A" % (hms, ns, t % 360)))
+        lines.append(sentence("GNVTG,%.1f,T,,M,12.5,N,23.1,K,A" % (t % 360)))
+        lines.append(sentence("GNGGA,%s,%s,1,09,1.0%d,%.1f,M,-33.1,M,," % (hms, ns, t % 10, 20 + t % 7)))
+        lines.append(sentence("GNGSA,A,3,02,05,12,13,15,18,24,25,29,,,,1.8%d,1.0%d,1.50" % (t % 10, t % 10)))
+        lines.append(sentence("GNGSA,A,3,65,66,72,81,88,,,,,,,,1.8%d,1.0%d,1.50" % (t % 10, t % 10)))
+        for talker, count in (("GP", 12), ("GL", 9)):
+            pages = (count + 3) // 4
+            for page in range(pages):
+                sats = "".join(",%02d,%02d,%03d,%02d" % (page * 4 + i + 1, 10 + i * 15, i * 90, 30 + i)
+                               for i in range(min(4, count - page * 4)))
+                lines.append(sentence("%sGSV,%d,%d,%02d%s" % (talker, pages, page + 1, count, sats)))
+        lines.append(sentence("GNGLL,%s,%s,A,A" % (ns, hms)))
+    return "".join(lines)
+
+
+def build(workdir):
+    with open(os.path.join(workdir, "Particle.h"), "w") as f:
+        f.write(PARTICLE_STUB)
+    binary = os.path.join(workdir, "nmea_bench")
+    subprocess.check_call(["g++", "-O2", "-std=c++11", "-I", workdir, "-I", LIB,
+                           os.path.join(HERE, "nmea_bench.cpp"), os.path.join(LIB, "TinyGPS++.cpp"),
+                           "-o", binary])
+    return binary
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("log", nargs="?", help="NMEA log, generated when missing")
+    parser.add_argument("--seconds", type=int, default=600, help="length of the generated log")
+    parser.add_argument("--repeat", type=int, default=50, help="passes over the log per mode")
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as workdir:
+        log = args.log
+        if log is None:
+            log = os.path.join(workdir, "generated.nmea")
+            with open(log, "w") as f:
+                f.write(generate(args.seconds))
+        output = subprocess.check_output([build(workdir), log, str(args.repeat)]).decode()
+
+    modes = {}
+    for line in output.splitlines():
+        key, value = line.split(" ", 1)
+        if key == "mode":
+            mode = modes.setdefault(value, {})
+        else:
+            mode[key] = value
+    full, filtered = modes["full"], modes["filtered"]
+    for key in ("bytes_per_us", "skipped") + VALUES:
+        print("%-16s %14s %14s" % (key, full[key], filtered[key]))
+    print("speedup          %.2fx" % (float(filtered["bytes_per_us"]) / float(full["bytes_per_us"])))
+
+    different = [key for key in VALUES if full[key] != filtered[key]]
+    if different:
+        print("FAIL filtered mode decodes differently: %s" % ", ".join(different))
+        return 1
+    if int(filtered["skipped"]) == 0:
+        print("FAIL no sentence skipped in filtered mode")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Decode a Cityscanner data file (CSV or binary records) into JSON lines.
+
+Every data file starts with one header line per record type, written from the
+schema in src/cityscanner_schema.cpp:
+
+    #<payload_type>,<name>:<type>:<unit>:<scale>,...
+    #records,csv|binary
+
+Binary records are a uint16 length (included) followed by the fields, little
+endian. Numbers are stored as round(value * scale), "na" as the largest value
+of unsigned types, the smallest of signed types and NaN for f32.
+
+    python3 record_decode.py 10211432.csv
+    python3 record_decode.py 10211432.bin > records.jsonl
+"""
+import json
+import math
+import struct
+import sys
+
+# Keep in sync with FieldType in src/cityscanner_schema.h
+TYPES = {
+    "u8": ("<B", 0xFF),
+    "u16": ("<H", 0xFFFF),
+    "u32": ("<I", 0xFFFFFFFF),
+    "i16": ("<h", -0x8000),
+    "i32": ("<i", -0x80000000),
+    "f32": ("<f", None),
+}
+
+
+def read_header(data):
+    """Returns the layout of each payload type, the record format and where the records start."""
+    layouts, record_format, offset = {}, "csv", 0
+    while data.startswith(b"#", offset):
+        end = data.index(b"\n", offset)
+        words = data[offset + 1:end].decode().strip().split(",")
+        offset = end + 1
+        if words[0] == "records":
+            record_format = words[1]
+            break
+        layouts[int(words[0])] = [tuple(field.split(":")) for field in words[1:]]
+    return layouts, record_format, offset
+
+
+def number(text):
+    if text in ("", "na"):
+        return None
+    try:
+        return int(text)
+    except ValueError:
+        return float(text)
+
+
+def decode_csv(layouts, lines):
+    for line in lines:
+        line = line.strip()
+        if not line or line.startswith("#"):
+            continue
+        payload_type = int(line.split(",", 1)[0])
+        layout = layouts.get(payload_type)
+        if layout is None:
+            yield {"payload_type": payload_type, "raw": line}
+            continue
+        # a text field at the end takes the rest of the line
+        columns = line.split(",", len(layout) - 1)
+        record = {}
+        for (name, kind, unit, scale), text in zip(layout, columns):
+            record[name] = text if kind == "str" else number(text)
+        yield record
+
+
+def decode_binary(layouts, data, offset):
+    while offset + 3 <= len(data):
+        length = struct.unpack_from("<H", data, offset)[0]
+        end = offset + length
+        payload_type = data[offset + 2]
+        position = offset + 2
+        record = {}
+        for name, kind, unit, scale in layouts.get(payload_type, []):
+            if kind == "str":
+                size = data[position]
+                record[name] = data[position + 1:position + 1 + size].decode(errors="replace")
+                position += 1 + size
+                continue
+            code, missing = TYPES[kind]
+            value = struct.unpack_from(code, data, position)[0]
+            position += struct.calcsize(code)
+            if (missing is None and math.isnan(value)) or value == missing:
+                record[name] = None
+            elif kind == "f32":
+                record[name] = value
+            else:
+                record[name] = value / float(scale) if float(scale) != 1 else value
+        if position != end:
+            record["error"] = "length %d, layout %d" % (length, position - offset)
+        yield record
+        offset = end
+
+
+def main():
+    data = open(sys.argv[1], "rb").read() if len(sys.argv) > 1 else sys.stdin.buffer.read()
+    layouts, record_format, offset = read_header(data)
+    if record_format == "binary":
+        records = decode_binary(layouts, data, offset)
+    else:
+        records = decode_csv(layouts, data[offset:].decode(errors="replace").splitlines())
+    for record in records:
+        print(json.dumps(record))
+
+
+if __name__ == "__main__":
+    main()
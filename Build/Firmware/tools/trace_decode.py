@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Decode the event trace of the Cityscanner firmware.
+
+Input is either the Serial output of the "trace,dump" CLI command (the lines
+between TRACE,<n> and TRACE,END) or the data of a TRACE event published by
+"trace,last" (hex events separated by spaces).
+
+    python3 trace_decode.py serial.log
+    particle serial monitor | python3 trace_decode.py
+"""
+import struct
+import sys
+
+# Keep in sync with TraceEvents in src/cityscanner_trace.h
+EVENTS = {
+    0: ("none", ""),
+    1: ("record_written", "records={0} length={1}"),
+    2: ("file_switch", "records={0}"),
+    3: ("dump_file", "size={0} tcp_result={1}"),
+    4: ("inactive", "seconds={0}"),
+    5: ("energy_tier", "tier={0}"),
+    6: ("schema_mismatch", "payload_type={0} length={1}"),
+    7: ("dump_scheduled", "in={0}s retry={1}"),
+}
+
+EVENT_FORMAT = "<IHHii"  # millis, id, sequence, arg0, arg1
+EVENT_HEX_LENGTH = struct.calcsize(EVENT_FORMAT) * 2
+
+
+def decode(hex_event):
+    timestamp, event_id, sequence, arg0, arg1 = struct.unpack(EVENT_FORMAT, bytes.fromhex(hex_event))
+    name, args = EVENTS.get(event_id, ("event_%d" % event_id, "{0} {1}"))
+    return sequence, "%10.3f  #%-5u %-16s %s" % (timestamp / 1000.0, sequence, name, args.format(arg0, arg1))
+
+
+def events(lines):
+    for line in lines:
+        for word in line.strip().split():
+            if len(word) == EVENT_HEX_LENGTH:
+                try:
+                    yield decode(word)
+                except ValueError:
+                    pass
+
+
+def main():
+    source = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    previous = None
+    for sequence, text in events(source):
+        if previous is not None and sequence != (previous + 1) & 0xFFFF:
+            print("... %u events lost" % ((sequence - previous - 1) & 0xFFFF))
+        print(text)
+        previous = sequence
+
+
+if __name__ == "__main__":
+    main()
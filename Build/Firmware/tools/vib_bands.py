@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""Check the fixed-point Goertzel vibration bands against a floating point DFT.
+
+Mirrors MotionService::goertzel() and getVIBRATIONdata() in src/motion_service.cpp
+(Q14 coefficients, int32 state, 64-bit products, axis mean removed) and the byte
+order of KXTJ3::readAxes(). Random accelerometer rings are compared with the DFT
+of the same samples at each VIB_BANDS frequency, a tone at each band must read
+its RMS amplitude, full scale input must not overflow the int32 state. Exits with
+1 when a check fails.
+
+    python3 vib_bands.py
+    python3 vib_bands.py --trials 2000 --rate 50 --bands 3,6,12,20
+"""
+import argparse
+import cmath
+import math
+import random
+import struct
+import sys
+
+RING = 64           # MOTION_RING_SIZE in src/motion_service.h
+Q = 14              # GOERTZEL_Q in src/motion_service.cpp
+COUNTS_PER_G = 15987  # KXTJ3::rawToG() at the 2 g range of motion_service.cpp
+INT32 = 2 ** 31
+
+
+def c_div(a, b):
+    """C integer division, truncating towards zero"""
+    q = abs(a) // abs(b)
+    return q if (a >= 0) == (b >= 0) else -q
+
+
+def coefficient(band, rate):
+    return int(2 * math.cos(2 * math.pi * band / rate) * (1 << Q))
+
+
+def goertzel(raw, coeff, peaks=None):
+    """MotionService::goertzel() for one axis, RMS amplitude of the bin in raw >> 4 counts"""
+    values = [v >> 4 for v in raw]
+    mean = c_div(sum(values), len(values))
+    s1 = s2 = 0
+    for v in values:
+        s = v - mean + ((coeff * s1) >> Q) - s2
+        s2, s1 = s1, s
+        if peaks is not None:
+            peaks.append(abs(s))
+    power = s1 * s1 + s2 * s2 - (((coeff * s1) >> Q) * s2)
+    if peaks is not None:
+        peaks.append(abs(power) >> 32)  # the 64-bit power, compared with INT32 below
+    power = max(power, 0)
+    return int(math.sqrt(2 * power) / len(values))
+
+
+def dft(raw, band, rate):
+    """Same bin from the float samples, mean removed"""
+    values = [v / 16.0 for v in raw]
+    mean = sum(values) / len(values)
+    w = 2 * math.pi * band / rate
+    x = sum((v - mean) * cmath.exp(-1j * w * n) for n, v in enumerate(values))
+    return math.sqrt(2) * abs(x) / len(values)
+
+
+def band_mg(axes, band, rate, amplitude=goertzel):
+    """getVIBRATIONdata() for one band, all axes combined"""
+    coeff = coefficient(band, rate)
+    total = sum(amplitude(raw, coeff) ** 2 for raw in axes)
+    return 16.0 / COUNTS_PER_G * math.sqrt(total) * 1000
+
+
+def ring(rng, rate, tones, noise_mg):
+    """Three axes of raw int16 samples: gravity in a random orientation, tones and noise"""
+    theta, phi = rng.uniform(0, math.pi), rng.uniform(0, 2 * math.pi)
+    gravity = (math.sin(theta) * math.cos(phi), math.sin(theta) * math.sin(phi), math.cos(theta))
+    axes = []
+    for axis in range(3):
+        samples = []
+        for n in range(RING):
+            g = gravity[axis]
+            for freq, mg, phase in tones[axis]:
+                g += mg / 1000.0 * math.cos(2 * math.pi * freq * n / rate + phase)
+            g += rng.gauss(0, noise_mg / 1000.0)
+            samples.append(max(-32768, min(32767, int(round(g * COUNTS_PER_G)))))
+        axes.append(samples)
+    return axes
+
+
+def read_axes(buffer):
+    """KXTJ3::readAxes(): (int16_t)lsb | int16_t(msb << 8) for X, Y and Z"""
+    xyz = []
+    for i in range(3):
+        msb = ((buffer[2 * i + 1] << 8) & 0xFFFF)
+        msb = msb - 0x10000 if msb & 0x8000 else msb
+        xyz.append(buffer[2 * i] | msb)
+    return xyz
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--rate", type=int, default=25, help="MOTION_SAMPLE_RATE, Hz")
+    parser.add_argument("--bands", default="2,4,7,11", help="VIB_BANDS, Hz")
+    parser.add_argument("--trials", type=int, default=500)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+    bands = [int(b) for b in args.bands.split(",")]
+    rng = random.Random(args.seed)
+    failed = False
+
+    # fixed point against the float DFT on random road-like rings
+    worst = 0.0
+    for _ in range(args.trials):
+        tones = [[(rng.uniform(0.5, args.rate / 2.0), rng.uniform(0, 300), rng.uniform(0, 2 * math.pi))
+                  for _ in range(3)] for _ in range(3)]
+        axes = ring(rng, args.rate, tones, rng.uniform(0, 20))
+        for band in bands:
+            fixed = band_mg(axes, band, args.rate)
+            exact = band_mg(axes, band, args.rate, lambda raw, coeff: dft(raw, band, args.rate))
+            worst = max(worst, abs(fixed - exact) - 0.01 * exact)
+    print("fixed vs DFT       worst error %.2f mg above 1%% over %d rings" % (worst, args.trials))
+    # each axis amplitude is truncated to whole counts (1 mg), sqrt(3) mg over the three axes
+    if worst > math.sqrt(3):
+        print("FAIL fixed point band differs from the DFT")
+        failed = True
+
+    # a tone at a band reads its RMS amplitude and stays the largest band
+    for band in bands:
+        tones = [[], [], [(band, 100.0, 0.3)]]
+        axes = ring(rng, args.rate, tones, 0)
+        readings = [band_mg(axes, b, args.rate) for b in bands]
+        reading = readings[bands.index(band)]
+        print("100 mg at %2d Hz    %s mg" % (band, " ".join("%6.1f" % r for r in readings)))
+        if abs(reading - 100 / math.sqrt(2)) > 0.1 * 100 / math.sqrt(2) or reading != max(readings):
+            print("FAIL %d Hz tone does not read 70.7 mg in its own band" % band)
+            failed = True
+
+    # full scale square wave at each band, the int32 state must not overflow
+    peak = 0
+    for band in bands:
+        raw = [32767 if math.cos(2 * math.pi * band * n / args.rate) >= 0 else -32768 for n in range(RING)]
+        peaks = []
+        goertzel(raw, coefficient(band, args.rate), peaks)
+        peak = max(peak, max(peaks[:-1]))
+        if peaks[-1] >= INT32:
+            print("FAIL %d Hz full scale power overflows int64" % band)
+            failed = True
+    print("full scale state   %d of %d" % (peak, INT32))
+    if peak >= INT32:
+        print("FAIL Goertzel state overflows int32")
+        failed = True
+
+    # burst read byte order against little endian int16
+    values = [-32768, -32767, -4096, -256, -255, -1, 0, 1, 255, 256, 4095, 32767]
+    for _ in range(1000):
+        xyz = [rng.choice(values + [rng.randint(-32768, 32767)]) for _ in range(3)]
+        if read_axes(struct.pack("<3h", *xyz)) != xyz:
+            print("FAIL readAxes() decodes %s as %s" % (xyz, read_axes(struct.pack("<3h", *xyz))))
+            failed = True
+            break
+    else:
+        print("readAxes()         1000 bursts decoded as little endian int16")
+
+    print("cost per record    %d multiply-adds (%d bands x 3 axes x %d samples)" % (len(bands) * 3 * RING, len(bands), RING))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())